@@ -54,10 +54,18 @@ DevPrivateKeyRec glamor_gc_private_key;
 PixmapPtr
 glamor_get_drawable_pixmap(DrawablePtr drawable)
 {
+    PixmapPtr pixmap;
+
     if (drawable->type == DRAWABLE_WINDOW)
-        return drawable->pScreen->GetWindowPixmap((WindowPtr) drawable);
+        pixmap = drawable->pScreen->GetWindowPixmap((WindowPtr) drawable);
     else
-        return (PixmapPtr) drawable;
+        pixmap = (PixmapPtr) drawable;
+
+    /* Where drawing starts. Callers can't fail, so rather than return
+     * a pixmap without storage, drop its contents if it can't be had */
+    if (!glamor_pixmap_thaw(pixmap))
+        glamor_cold_discard(pixmap);
+    return pixmap;
 }
 
 static void
@@ -133,9 +141,17 @@ glamor_get_pixmap_texture(PixmapPtr pixmap)
 {
     glamor_pixmap_private *pixmap_priv = glamor_get_pixmap_private(pixmap);
 
+    if (!glamor_pixmap_thaw(pixmap))
+        return 0;
+
     if (pixmap_priv->type != GLAMOR_TEXTURE_ONLY)
         return 0;
 
+    /* The caller may draw to it */
+    if (!glamor_pixmap_unshare(pixmap))
+        return 0;
+    glamor_pixmap_begin_write(pixmap, pixmap_priv, NULL);
+
     return pixmap_priv->fbo->tex;
 }
 
@@ -173,6 +189,42 @@ glamor_bind_texture(glamor_screen_private *glamor_priv, GLenum texture,
         else
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_R, GL_ZERO);
     }
+
+    /* Undo any red/blue swap left over from render */
+    if (fbo->swap_rb)
+        glamor_set_texture_swap_rb(fbo, FALSE);
+}
+
+/*
+ * Swap red and blue when sampling the bound texture, for pictures
+ * whose format has them the other way around from the pixmap's
+ * texture.
+ */
+void
+glamor_set_texture_swap_rb(glamor_pixmap_fbo *fbo, Bool swap)
+{
+    if (fbo->swap_rb == swap)
+        return;
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_R, swap ? GL_BLUE : GL_RED);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, swap ? GL_RED : GL_BLUE);
+    fbo->swap_rb = swap;
+}
+
+/*
+ * Pixmaps left in system memory. Storage fb allocates here only
+ * changes through fb, unlike the client's shared memory attached to
+ * pixmaps created empty, so textures cached from it can be trusted.
+ */
+static PixmapPtr
+glamor_create_memory_pixmap(ScreenPtr screen, int w, int h, int depth,
+                            unsigned int usage)
+{
+    PixmapPtr pixmap = fbCreatePixmap(screen, w, h, depth, usage);
+
+    if (pixmap && w && h)
+        glamor_get_pixmap_private(pixmap)->fb_bits = pixmap->devPrivate.ptr;
+    return pixmap;
 }
 
 PixmapPtr
@@ -191,17 +243,19 @@ glamor_create_pixmap(ScreenPtr screen, int w, int h, int depth,
 
     if ((depth == 8 && usage != GLAMOR_CREATE_FBO_NO_FBO) ||
 	(w == h && w == 24 && depth == 32)) {
-        return fbCreatePixmap(screen, w, h, depth, usage);
+        return glamor_create_memory_pixmap(screen, w, h, depth, usage);
     }
     if ((usage == GLAMOR_CREATE_PIXMAP_CPU
          || (usage == CREATE_PIXMAP_USAGE_GLYPH_PICTURE &&
              w <= glamor_priv->glyph_max_dim &&
              h <= glamor_priv->glyph_max_dim)
          || (w == 0 && h == 0)
-         || !glamor_check_pixmap_fbo_depth(depth))
+         || !(glamor_check_pixmap_fbo_depth(depth) ||
+              (depth == 1 && glamor_priv->gpu_bitmaps))
+         || (depth == 30 && !glamor_priv->has_rgb10_a2))
         || (!GLAMOR_TEXTURED_LARGE_PIXMAP &&
             !glamor_check_fbo_size(glamor_priv, w, h)))
-        return fbCreatePixmap(screen, w, h, depth, usage);
+        return glamor_create_memory_pixmap(screen, w, h, depth, usage);
     else
         pixmap = fbCreatePixmap(screen, 0, 0, depth, usage);
 
@@ -233,10 +287,11 @@ glamor_create_pixmap(ScreenPtr screen, int w, int h, int depth,
 
     if (fbo == NULL) {
         fbDestroyPixmap(pixmap);
-        return fbCreatePixmap(screen, w, h, depth, usage);
+        return glamor_create_memory_pixmap(screen, w, h, depth, usage);
     }
 
     glamor_pixmap_attach_fbo(pixmap, fbo);
+    glamor_cold_track(pixmap, usage);
 
     return pixmap;
 }
@@ -245,7 +300,24 @@ Bool
 glamor_destroy_pixmap(PixmapPtr pixmap)
 {
     if (pixmap->refcnt == 1) {
+        glamor_pixmap_private *priv;
+
+        glamor_cold_untrack(pixmap);
         glamor_pixmap_destroy_fbo(pixmap);
+
+        priv = glamor_get_pixmap_private(pixmap);
+        glamor_readback_free(pixmap, priv);
+        glamor_prefetch_free(pixmap, priv);
+        glamor_checksum_free(priv);
+        if (priv->mip_listed) {
+            xorg_list_del(&priv->mip_link);
+            priv->mip_listed = FALSE;
+        }
+        if (priv->tile_fbo) {
+            glamor_destroy_fbo(glamor_get_screen_private(pixmap->drawable.pScreen),
+                               priv->tile_fbo);
+            priv->tile_fbo = NULL;
+        }
     }
 
     return fbDestroyPixmap(pixmap);
@@ -257,7 +329,9 @@ glamor_block_handler(ScreenPtr screen)
     glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
 
     glamor_make_current(glamor_priv);
+    glamor_trace_begin(GLAMOR_TRACE_FLUSH, 0, 0);
     glFlush();
+    glamor_trace_end(GLAMOR_TRACE_FLUSH);
 }
 
 static void
@@ -266,12 +340,34 @@ _glamor_block_handler(ScreenPtr screen, void *timeout)
     glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
 
     glamor_make_current(glamor_priv);
+    glamor_pressure_check(screen);
+    /* Otherwise done by the idle scheduler */
+    if (!glamor_priv->idle_ntasks)
+        glamor_cold_reclaim(screen, FALSE);
+    glamor_trace_begin(GLAMOR_TRACE_FLUSH, 0, 0);
     glFlush();
+    glamor_trace_end(GLAMOR_TRACE_FLUSH);
+    glamor_trace_block();
 
     screen->BlockHandler = glamor_priv->saved_procs.block_handler;
     screen->BlockHandler(screen, timeout);
     glamor_priv->saved_procs.block_handler = screen->BlockHandler;
     screen->BlockHandler = _glamor_block_handler;
+
+    glamor_idle_block(screen, timeout);
+}
+
+static void
+_glamor_wakeup_handler(ScreenPtr screen, int result)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+
+    glamor_idle_wakeup(screen, result);
+
+    screen->WakeupHandler = glamor_priv->saved_procs.wakeup_handler;
+    screen->WakeupHandler(screen, result);
+    glamor_priv->saved_procs.wakeup_handler = screen->WakeupHandler;
+    screen->WakeupHandler = _glamor_wakeup_handler;
 }
 
 static void
@@ -288,6 +384,86 @@ glamor_set_debug_level(int *debug_level)
 
 int glamor_debug_level;
 
+/*
+ * Mipmaps for downscaled composite sources are off unless given a
+ * memory budget, in MiB, through GLAMOR_MIPMAP_BUDGET
+ */
+static void
+glamor_set_mipmap_budget(glamor_screen_private *glamor_priv)
+{
+    char *budget_string;
+    int budget;
+
+    glamor_priv->mipmap_budget = 0;
+
+    if (!glamor_priv->has_mipmap)
+        return;
+
+    budget_string = getenv("GLAMOR_MIPMAP_BUDGET");
+    if (budget_string && sscanf(budget_string, "%d", &budget) == 1 &&
+        budget > 0)
+        glamor_priv->mipmap_budget = (size_t) budget << 20;
+}
+
+/*
+ * Check whether depth 16 pixmaps can live in RGB565 textures, which
+ * halves their memory and bandwidth and avoids converting on every
+ * transfer. Desktop GL only has a sized 565 internal format with
+ * ES2 compatibility, and the result must be renderable.
+ */
+static Bool
+glamor_check_renderable(GLenum iformat, GLenum format, GLenum type)
+{
+    GLuint tex, fb;
+    GLenum status;
+
+    while (glGetError() != GL_NO_ERROR)
+        ;
+
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, iformat, 16, 16, 0, format, type, NULL);
+
+    glGenFramebuffers(1, &fb);
+    glBindFramebuffer(GL_FRAMEBUFFER, fb);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, tex, 0);
+    status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fb);
+    glDeleteTextures(1, &tex);
+
+    return status == GL_FRAMEBUFFER_COMPLETE && glGetError() == GL_NO_ERROR;
+}
+
+static Bool
+glamor_check_rgb565(glamor_screen_private *glamor_priv, int gl_version)
+{
+    if (glamor_priv->gl_flavor == GLAMOR_GL_DESKTOP &&
+        gl_version < 41 &&
+        !epoxy_has_gl_extension("GL_ARB_ES2_compatibility"))
+        return FALSE;
+
+    return glamor_check_renderable(glamor_priv->gl_flavor == GLAMOR_GL_DESKTOP ?
+                                   GL_RGB565 : GL_RGB,
+                                   GL_RGB, GL_UNSIGNED_SHORT_5_6_5);
+}
+
+/*
+ * Depth 30 pixmaps need a 10 bit per channel texture laid out like
+ * x2r10g10b10, which only desktop GL can upload and read back.
+ */
+static Bool
+glamor_check_rgb10_a2(glamor_screen_private *glamor_priv, int gl_version)
+{
+    if (glamor_priv->gl_flavor != GLAMOR_GL_DESKTOP || gl_version < 30)
+        return FALSE;
+
+    return glamor_check_renderable(GL_RGB10_A2, GL_BGRA,
+                                   GL_UNSIGNED_INT_2_10_10_10_REV);
+}
+
 void
 glamor_gldrawarrays_quads_using_indices(glamor_screen_private *glamor_priv,
                                         unsigned count)
@@ -654,7 +830,39 @@ glamor_init(ScreenPtr screen, unsigned int flags)
         glamor_priv->one_channel_format = GL_RED;
     }
 
+    /* GLES2 can only mipmap NPOT textures with GL_OES_texture_npot */
+    glamor_priv->has_mipmap =
+        glamor_priv->gl_flavor == GLAMOR_GL_DESKTOP ||
+        gl_version >= 30 ||
+        epoxy_has_gl_extension("GL_OES_texture_npot");
+
+    glamor_priv->has_rgb565 = glamor_check_rgb565(glamor_priv, gl_version);
+    glamor_priv->has_rgb10_a2 = glamor_check_rgb10_a2(glamor_priv, gl_version);
+    LogMessageVerb(X_INFO, 3, "glamor%d: 10 bit per channel rendering %s\n",
+                   screen->myNum,
+                   glamor_priv->has_rgb10_a2 ? "supported" : "unsupported");
+
+    /* Ordered dithering of composites into 565 destinations */
+    glamor_priv->dither = glamor_priv->has_rgb565 &&
+        getenv("GLAMOR_DITHER") != NULL;
+
+    /* Depth 1 pixmaps as one byte per pixel textures; they need to be
+     * renderable, which alpha-only textures aren't */
+    glamor_priv->gpu_bitmaps = glamor_priv->one_channel_format == GL_RED &&
+        getenv("GLAMOR_GPU_BITMAPS") != NULL;
+
     glamor_set_debug_level(&glamor_debug_level);
+    xorg_list_init(&glamor_priv->mip_pixmaps);
+    glamor_set_mipmap_budget(glamor_priv);
+    glamor_cold_init(screen);
+    glamor_prepare_init(screen);
+    glamor_verify_init(screen);
+    glamor_dispatch_init(screen);
+    glamor_stencil_init(screen);
+    glamor_readback_init(screen);
+    glamor_prefetch_init(screen);
+    glamor_idle_init(screen);
+    glamor_pressure_init(screen);
 
     glamor_priv->saved_procs.create_screen_resources =
         screen->CreateScreenResources;
@@ -665,6 +873,8 @@ glamor_init(ScreenPtr screen, unsigned int flags)
 
     glamor_priv->saved_procs.block_handler = screen->BlockHandler;
     screen->BlockHandler = _glamor_block_handler;
+    glamor_priv->saved_procs.wakeup_handler = screen->WakeupHandler;
+    screen->WakeupHandler = _glamor_wakeup_handler;
 
     if (!glamor_composite_glyphs_init(screen)) {
         ErrorF("Failed to initialize composite masks\n");
@@ -718,6 +928,8 @@ glamor_init(ScreenPtr screen, unsigned int flags)
 #endif
     glamor_pixmap_init(screen);
     glamor_sync_init(screen);
+    glamor_threads_init();
+    glamor_trace_init();
 
     glamor_priv->screen = screen;
 
@@ -757,6 +969,19 @@ glamor_close_screen(ScreenPtr screen)
     glamor_priv = glamor_get_screen_private(screen);
     glamor_sync_close(screen);
     glamor_composite_glyphs_fini(screen);
+    glamor_trap_cache_fini(screen);
+    glamor_cold_fini(screen);
+    glamor_verify_fini(screen);
+    glamor_dispatch_fini(screen);
+    glamor_readback_fini(screen);
+    glamor_prefetch_fini(screen);
+    glamor_idle_fini(screen);
+    glamor_pressure_fini(screen);
+    glamor_threads_fini();
+    glamor_trace_fini();
+#ifdef GLAMOR_GRADIENT_SHADER
+    glamor_fini_gradient_shader(screen);
+#endif
     screen->CloseScreen = glamor_priv->saved_procs.close_screen;
     screen->CreateScreenResources =
         glamor_priv->saved_procs.create_screen_resources;
@@ -770,6 +995,7 @@ glamor_close_screen(ScreenPtr screen)
     screen->CopyWindow = glamor_priv->saved_procs.copy_window;
     screen->BitmapToRegion = glamor_priv->saved_procs.bitmap_to_region;
     screen->BlockHandler = glamor_priv->saved_procs.block_handler;
+    screen->WakeupHandler = glamor_priv->saved_procs.wakeup_handler;
 
     ps->Composite = glamor_priv->saved_procs.composite;
     ps->Trapezoids = glamor_priv->saved_procs.trapezoids;
@@ -777,6 +1003,33 @@ glamor_close_screen(ScreenPtr screen)
     ps->CompositeRects = glamor_priv->saved_procs.composite_rects;
     ps->Glyphs = glamor_priv->saved_procs.glyphs;
 
+    if (glamor_priv->mipmap_budget)
+        LogMessageVerb(X_INFO, 3,
+                       "glamor%d: mipmaps: %lu generated, %lu reused, "
+                       "%lu over budget\n", screen->myNum,
+                       glamor_priv->mipmap_generations,
+                       glamor_priv->mipmap_hits,
+                       glamor_priv->mipmap_over_budget);
+
+    LogMessageVerb(X_INFO, 3,
+                   "glamor%d: shared FBOs: %lu copies shared, %lu unshared\n",
+                   screen->myNum, glamor_priv->fbo_shares,
+                   glamor_priv->fbo_unshares);
+
+    if (glamor_priv->staging_rows)
+        LogMessageVerb(X_INFO, 3,
+                       "glamor%d: fb staging: %llu of %llu rows uploaded\n",
+                       screen->myNum,
+                       (unsigned long long) glamor_priv->staging_dirty_rows,
+                       (unsigned long long) glamor_priv->staging_rows);
+
+    if (glamor_priv->stencil_clip_draws)
+        LogMessageVerb(X_INFO, 3,
+                       "glamor%d: stencil clipping: %lu draws, "
+                       "%lu clip list updates\n", screen->myNum,
+                       glamor_priv->stencil_clip_draws,
+                       glamor_priv->stencil_clip_updates);
+
     screen_pixmap = screen->GetScreenPixmap(screen);
     glamor_pixmap_destroy_fbo(screen_pixmap);
 
@@ -820,7 +1073,8 @@ glamor_fd_from_pixmap(ScreenPtr screen,
     switch (pixmap_priv->type) {
     case GLAMOR_TEXTURE_DRM:
     case GLAMOR_TEXTURE_ONLY:
-        if (!glamor_pixmap_ensure_fbo(pixmap, GL_RGBA, 0))
+        if (!glamor_pixmap_ensure_fbo(pixmap,
+                                      gl_iformat_for_pixmap(pixmap), 0))
             return -1;
         return glamor_egl_dri3_fd_name_from_tex(screen,
                                                 pixmap,
@@ -860,7 +1114,8 @@ glamor_name_from_pixmap(PixmapPtr pixmap, CARD16 *stride, CARD32 *size)
     switch (pixmap_priv->type) {
     case GLAMOR_TEXTURE_DRM:
     case GLAMOR_TEXTURE_ONLY:
-        if (!glamor_pixmap_ensure_fbo(pixmap, GL_RGBA, 0))
+        if (!glamor_pixmap_ensure_fbo(pixmap,
+                                      gl_iformat_for_pixmap(pixmap), 0))
             return -1;
         return glamor_egl_dri3_fd_name_from_tex(pixmap->drawable.pScreen,
                                                 pixmap,
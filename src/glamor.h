@@ -277,9 +277,11 @@ extern _X_EXPORT Bool glamor_back_pixmap_from_fd(PixmapPtr pixmap,
 /* @glamor_egl_init: Initialize EGL environment.
  *
  * @scrn: Current screen info pointer.
- * @fd:   Current drm fd.
+ * @fd:   Current drm fd, or -1 to run headless on EGL's surfaceless or
+ *        device platform, without buffer sharing or DRI3.
  *
- * This function creates and intialize EGL contexts.
+ * This function creates and intialize EGL contexts. Software renderers
+ * are refused unless GLAMOR_ALLOW_SOFTWARE is set in the environment.
  * Should be called from DDX's preInit function.
  * Return TRUE if success, otherwise return FALSE.
  * */
@@ -359,6 +361,17 @@ extern void _X_EXPORT glamor_copy_window(WindowPtr window, DDXPointRec old_origi
 extern _X_EXPORT void glamor_finish(ScreenPtr screen);
 #define HAS_GLAMOR_TEXT 1
 
+/* glamor_pixmap_changed_tiles: add the areas of the pixmap that changed
+ * since the last call to 'changed', at the granularity of 64x64 tiles.
+ * The check runs on the GPU and only reads back one checksum per tile,
+ * so screen scrapers can then fetch just what changed. The first call
+ * reports the whole pixmap. Returns FALSE if the pixmap can't be checked
+ * this way, in which case callers must assume everything changed.
+ */
+extern _X_EXPORT Bool glamor_pixmap_changed_tiles(PixmapPtr pixmap,
+                                                  RegionPtr changed);
+#define HAS_GLAMOR_CHANGED_TILES 1
+
 #ifdef GLAMOR_FOR_XORG
 extern _X_EXPORT XF86VideoAdaptorPtr glamor_xv_init(ScreenPtr pScreen,
                                                     int num_texture_ports);
@@ -0,0 +1,234 @@
+/*
+ * Copyright © 2014 Keith Packard
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include "glamor_priv.h"
+#include "glamor_transfer.h"
+#include "glamor_transform.h"
+
+/*
+ * Find the changed areas of a pixmap without reading it back.
+ *
+ * A single pass hashes each GLAMOR_CHECKSUM_TILE square tile of the
+ * pixmap into one pixel of a small RGBA texture, which is all that
+ * gets read back. Comparing that table against the one from the
+ * previous call gives the tiles whose contents changed, which is
+ * what screen scrapers want before fetching anything.
+ *
+ * The hash is FNV-1 over each texel, with the channels scaled to ten
+ * bits so that 8 and 10 bit formats both hash every bit. Any single
+ * changed pixel changes the hash of its tile; several changes in one
+ * tile collide with a chance of 1 in 2^32.
+ */
+
+/* Must match TILE in the shader */
+#define GLAMOR_CHECKSUM_TILE    64
+
+static Bool
+use_tile_checksum(PixmapPtr pixmap, GCPtr gc, glamor_program *prog, void *arg)
+{
+    glamor_pixmap_private *src_priv = arg;
+
+    glamor_bind_texture(glamor_get_screen_private(pixmap->drawable.pScreen),
+                        GL_TEXTURE0, src_priv->fbo, FALSE);
+    return TRUE;
+}
+
+static const glamor_facet glamor_facet_tile_checksum = {
+    .name = "tile_checksum",
+    .version = 130,
+    .vs_vars = "attribute vec2 primitive;\n",
+    .vs_exec = GLAMOR_POS(gl_Position, primitive.xy),
+    .fs_vars = "#define TILE 64\n",
+    .fs_exec = ("       ivec2 size = textureSize(sampler, 0);\n"
+                "       ivec2 start = ivec2(gl_FragCoord.xy) * TILE;\n"
+                "       ivec2 end = min(start + ivec2(TILE), size);\n"
+                "       uint h = 2166136261u;\n"
+                "       for (int y = start.y; y < end.y; y++) {\n"
+                "               for (int x = start.x; x < end.x; x++) {\n"
+                "                       uvec4 c = uvec4(round(texelFetch(sampler, ivec2(x, y), 0) * 1023.0));\n"
+                "                       h = (h ^ (c.r | (c.g << 10) | (c.b << 20))) * 16777619u;\n"
+                "                       h = (h ^ c.a) * 16777619u;\n"
+                "               }\n"
+                "       }\n"
+                "       gl_FragColor = vec4(uvec4(h, h >> 8, h >> 16, h >> 24) & uvec4(255u)) / 255.0;\n"),
+    .locations = glamor_program_location_fillsamp,
+    .use = use_tile_checksum,
+};
+
+/*
+ * Draw the checksum table for the pixmap and read it back into
+ * checksums, one uint32_t per tile in row order.
+ */
+static Bool
+glamor_checksum_tiles(PixmapPtr pixmap, glamor_pixmap_private *priv,
+                      int width, int height, uint32_t *checksums)
+{
+    ScreenPtr screen = pixmap->drawable.pScreen;
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_program *prog = &glamor_priv->tile_checksum_prog;
+    PixmapPtr table;
+    Bool ret = FALSE;
+    GLshort *v;
+    char *vbo_offset;
+    int table_width = width;
+
+    glamor_make_current(glamor_priv);
+
+    if (prog->failed)
+        return FALSE;
+
+    if (!prog->prog) {
+        if (!glamor_build_program(screen, prog, &glamor_facet_tile_checksum,
+                                  NULL, NULL, NULL))
+            return FALSE;
+    }
+
+    /* glamor_create_pixmap() keeps 24x24 depth 32 pixmaps in memory
+     * whatever the usage; a spare column gets this one an FBO */
+    if (width == 24 && height == 24)
+        table_width++;
+
+    table = glamor_create_pixmap(screen, table_width, height, 32,
+                                 GLAMOR_CREATE_NO_LARGE);
+    if (!table)
+        return FALSE;
+
+    if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(glamor_get_pixmap_private(table)))
+        goto bail;
+
+    if (!glamor_use_program(table, NULL, prog, priv))
+        goto bail;
+
+    glamor_set_alu(screen, GXcopy);
+
+    v = glamor_get_vbo_space(screen, 8 * sizeof (GLshort), &vbo_offset);
+
+    glEnableVertexAttribArray(GLAMOR_VERTEX_POS);
+    glVertexAttribPointer(GLAMOR_VERTEX_POS, 2, GL_SHORT, GL_FALSE,
+                          2 * sizeof (GLshort), vbo_offset);
+
+    v[0] = 0;           v[1] = 0;
+    v[2] = 0;           v[3] = height;
+    v[4] = width;       v[5] = height;
+    v[6] = width;       v[7] = 0;
+
+    glamor_put_vbo_space(screen);
+
+    glamor_set_destination_drawable(&table->drawable, 0, FALSE, FALSE,
+                                    prog->matrix_uniform, NULL, NULL);
+
+    glamor_glDrawArrays_GL_QUADS(glamor_priv, 1);
+    glDisableVertexAttribArray(GLAMOR_VERTEX_POS);
+
+    glamor_download_rect(table, 0, 0, width, height, (uint8_t *) checksums);
+    ret = TRUE;
+
+bail:
+    glamor_destroy_pixmap(table);
+    return ret;
+}
+
+/*
+ * Free the checksums of a pixmap being destroyed
+ */
+void
+glamor_checksum_free(glamor_pixmap_private *priv)
+{
+    free(priv->tile_checksums);
+    priv->tile_checksums = NULL;
+}
+
+/**
+ * Add the tiles of the pixmap that changed since the last call to
+ * 'changed', in pixmap coordinates. The first call, and the first
+ * after the pixmap changes size, adds the whole pixmap. Returns FALSE,
+ * leaving 'changed' alone, when the pixmap can't be checksummed on the
+ * GPU. That includes exported pixmaps, the screen pixmap among them,
+ * as the serial misses what clients render to them.
+ */
+Bool
+glamor_pixmap_changed_tiles(PixmapPtr pixmap, RegionPtr changed)
+{
+    ScreenPtr screen = pixmap->drawable.pScreen;
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_pixmap_private *priv = glamor_get_pixmap_private(pixmap);
+    int width = pixmap->drawable.width;
+    int height = pixmap->drawable.height;
+    int tiles_x = (width + GLAMOR_CHECKSUM_TILE - 1) / GLAMOR_CHECKSUM_TILE;
+    int tiles_y = (height + GLAMOR_CHECKSUM_TILE - 1) / GLAMOR_CHECKSUM_TILE;
+    uint32_t *checksums, *old;
+    int x, y;
+
+    if (glamor_priv->glsl_version < 130)
+        return FALSE;
+
+    if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(priv) || glamor_pixmap_priv_is_large(priv))
+        return FALSE;
+
+    if (priv->type != GLAMOR_TEXTURE_ONLY)
+        return FALSE;
+
+    /* Checksums of another size don't line up with these tiles */
+    old = priv->tile_checksums;
+    if (old && (priv->tile_checksum_w != tiles_x ||
+                priv->tile_checksum_h != tiles_y))
+        old = NULL;
+
+    /* Nothing can have changed */
+    if (old && priv->tile_checksum_serial == priv->serial)
+        return TRUE;
+
+    checksums = xallocarray(tiles_x * tiles_y, sizeof (uint32_t));
+    if (!checksums)
+        return FALSE;
+
+    if (!glamor_checksum_tiles(pixmap, priv, tiles_x, tiles_y, checksums)) {
+        free(checksums);
+        return FALSE;
+    }
+
+    for (y = 0; y < tiles_y; y++) {
+        for (x = 0; x < tiles_x; x++) {
+            int i = y * tiles_x + x;
+            BoxRec box;
+            RegionRec tile;
+
+            if (old && old[i] == checksums[i])
+                continue;
+
+            box.x1 = x * GLAMOR_CHECKSUM_TILE;
+            box.y1 = y * GLAMOR_CHECKSUM_TILE;
+            box.x2 = MIN(box.x1 + GLAMOR_CHECKSUM_TILE, width);
+            box.y2 = MIN(box.y1 + GLAMOR_CHECKSUM_TILE, height);
+            RegionInit(&tile, &box, 1);
+            RegionUnion(changed, changed, &tile);
+            RegionUninit(&tile);
+        }
+    }
+
+    free(priv->tile_checksums);
+    priv->tile_checksums = checksums;
+    priv->tile_checksum_w = tiles_x;
+    priv->tile_checksum_h = tiles_y;
+    priv->tile_checksum_serial = priv->serial;
+    return TRUE;
+}
@@ -0,0 +1,326 @@
+/*
+ * Copyright © 2014 Keith Packard
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include "glamor_priv.h"
+#include "glamor_transfer.h"
+
+#include <lz4.h>
+
+/*
+ * Cold tier for idle pixmaps.
+ *
+ * Pixmaps that haven't been touched for GLAMOR_COLD_TIMEOUT seconds
+ * are read back, LZ4-compressed into system memory and their FBOs
+ * freed. glamor_pixmap_thaw() restores them where drawing starts:
+ * glamor_get_drawable_pixmap(), glamor_prep_pixmap_box(),
+ * glamor_pixmap_ensure_fbo(), the tile of a fill and the paths taking
+ * a pixmap directly rather than a drawable, like PushPixels bitmaps.
+ *
+ * Pixmaps are only compressed from the block handler, between
+ * requests, so nothing can be holding on to the FBO being freed.
+ * Pixmaps glamor creates for itself aren't tracked; they are drawn
+ * with directly rather than through a drawable.
+ */
+
+/* Skip pixmaps too small to be worth the round trip */
+#define GLAMOR_COLD_MIN_SIZE            (64 * 1024)
+
+/* Bound the work done in one block handler call */
+#define GLAMOR_COLD_MAX_PER_SCAN        4
+
+unsigned int glamor_cold_epoch;
+
+void
+glamor_cold_init(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    char *timeout_string;
+    int timeout;
+
+    xorg_list_init(&glamor_priv->cold_pixmaps);
+    glamor_cold_epoch = GetTimeInMillis() / 1000;
+
+    timeout_string = getenv("GLAMOR_COLD_TIMEOUT");
+    if (timeout_string && sscanf(timeout_string, "%d", &timeout) == 1 &&
+        timeout > 0)
+        glamor_priv->cold_timeout = timeout;
+}
+
+void
+glamor_cold_fini(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+
+    if (!glamor_priv->cold_timeout)
+        return;
+
+    LogMessageVerb(X_INFO, 3,
+                   "glamor%d: cold pixmaps: %lu compressed, %lu restored, "
+                   "%llu -> %llu bytes, %llu us compressing, "
+                   "%llu us restoring\n", screen->myNum,
+                   glamor_priv->cold_stats.frozen,
+                   glamor_priv->cold_stats.thawed,
+                   (unsigned long long) glamor_priv->cold_stats.raw_bytes,
+                   (unsigned long long) glamor_priv->cold_stats.packed_bytes,
+                   (unsigned long long) glamor_priv->cold_stats.freeze_us,
+                   (unsigned long long) glamor_priv->cold_stats.thaw_us);
+}
+
+/*
+ * Start tracking a freshly created pixmap as a candidate for the
+ * cold tier.
+ */
+void
+glamor_cold_track(PixmapPtr pixmap, unsigned int usage)
+{
+    glamor_screen_private *glamor_priv =
+        glamor_get_screen_private(pixmap->drawable.pScreen);
+    glamor_pixmap_private *priv = glamor_get_pixmap_private(pixmap);
+
+    if (!glamor_priv->cold_timeout || usage >= GLAMOR_CREATE_PIXMAP_CPU)
+        return;
+
+    if (priv->type != GLAMOR_TEXTURE_ONLY ||
+        glamor_pixmap_priv_is_large(priv) ||
+        pixmap->devKind * pixmap->drawable.height < GLAMOR_COLD_MIN_SIZE)
+        return;
+
+    priv->cold_pixmap = pixmap;
+    priv->cold_epoch = glamor_cold_epoch;
+    xorg_list_add(&priv->cold_link, &glamor_priv->cold_pixmaps);
+}
+
+/*
+ * Stop tracking a pixmap that is going away, dropping any compressed
+ * copy without restoring it.
+ */
+void
+glamor_cold_untrack(PixmapPtr pixmap)
+{
+    glamor_pixmap_private *priv = glamor_get_pixmap_private(pixmap);
+
+    /* The link is only initialized for tracked pixmaps */
+    if (!priv->cold_pixmap)
+        return;
+
+    xorg_list_del(&priv->cold_link);
+    priv->cold_pixmap = NULL;
+    free(priv->cold_data);
+    priv->cold_data = NULL;
+    free(priv->cold_owned);
+    priv->cold_owned = NULL;
+}
+
+static Bool
+glamor_cold_freeze(ScreenPtr screen, glamor_pixmap_private *priv)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    PixmapPtr pixmap = priv->cold_pixmap;
+    int raw_size = pixmap->devKind * pixmap->drawable.height;
+    CARD64 start = GetTimeInMicros();
+    uint8_t *raw;
+    char *packed, *shrunk;
+    int packed_size;
+    BoxRec box;
+
+    /* Mapped for fb, or sharing its FBO with another pixmap */
+    if (priv->type != GLAMOR_TEXTURE_ONLY ||
+        !GLAMOR_PIXMAP_PRIV_HAS_FBO(priv) || priv->prepared ||
+        pixmap->devPrivate.ptr || priv->cold_data || priv->fbo->shared)
+        return FALSE;
+
+    raw = malloc(raw_size);
+    if (!raw)
+        return FALSE;
+
+    packed = malloc(LZ4_compressBound(raw_size));
+    if (!packed) {
+        free(raw);
+        return FALSE;
+    }
+
+    box.x1 = 0;
+    box.y1 = 0;
+    box.x2 = pixmap->drawable.width;
+    box.y2 = pixmap->drawable.height;
+    glamor_download_boxes(pixmap, &box, 1, 0, 0, 0, 0, raw, pixmap->devKind);
+
+    packed_size = LZ4_compress_default((char *) raw, packed, raw_size,
+                                       LZ4_compressBound(raw_size));
+    free(raw);
+
+    /* Not compressible enough to be worth it */
+    if (packed_size <= 0 || packed_size > raw_size / 2) {
+        free(packed);
+        return FALSE;
+    }
+
+    shrunk = realloc(packed, packed_size);
+    if (shrunk)
+        packed = shrunk;
+
+    glamor_pixmap_destroy_fbo(pixmap);
+    priv->gl_fbo = GLAMOR_FBO_UNATTACHED;
+    priv->cold_data = packed;
+    priv->cold_size = packed_size;
+
+    glamor_priv->cold_stats.frozen++;
+    glamor_priv->cold_stats.raw_bytes += raw_size;
+    glamor_priv->cold_stats.packed_bytes += packed_size;
+    glamor_priv->cold_stats.freeze_us += GetTimeInMicros() - start;
+    return TRUE;
+}
+
+/*
+ * Bring a compressed pixmap back into an FBO, or into system memory
+ * when there's no GPU memory for it. Returns FALSE, leaving it
+ * compressed, when there isn't the memory for either.
+ */
+Bool
+glamor_cold_thaw(PixmapPtr pixmap)
+{
+    ScreenPtr screen = pixmap->drawable.pScreen;
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_pixmap_private *priv = glamor_get_pixmap_private(pixmap);
+    int raw_size = pixmap->devKind * pixmap->drawable.height;
+    CARD64 start = GetTimeInMicros();
+    char *packed = priv->cold_data;
+    uint8_t *raw;
+    BoxRec box;
+
+    raw = malloc(raw_size);
+    if (!raw) {
+        LogMessageVerb(X_WARNING, 1,
+                       "glamor: out of memory restoring cold pixmap\n");
+        return FALSE;
+    }
+
+    if (LZ4_decompress_safe(packed, (char *) raw, priv->cold_size,
+                            raw_size) != raw_size) {
+        /* Nothing to get the contents back from; carry on without */
+        LogMessageVerb(X_ERROR, 0,
+                       "glamor: corrupt cold pixmap, contents lost\n");
+        memset(raw, 0, raw_size);
+    }
+
+    /* Clear this first, ensure_fbo thaws too */
+    priv->cold_data = NULL;
+    free(packed);
+
+    glamor_make_current(glamor_priv);
+
+    if (!glamor_pixmap_ensure_fbo(pixmap, gl_iformat_for_pixmap(pixmap), 0)) {
+        /* No GPU memory left; keep the pixmap in system memory */
+        priv->type = GLAMOR_MEMORY;
+        priv->cold_owned = raw;
+        pixmap->devPrivate.ptr = raw;
+        return TRUE;
+    }
+
+    box.x1 = 0;
+    box.y1 = 0;
+    box.x2 = pixmap->drawable.width;
+    box.y2 = pixmap->drawable.height;
+    glamor_upload_boxes(pixmap, &box, 1, 0, 0, 0, 0, raw, pixmap->devKind);
+    free(raw);
+
+    glamor_priv->cold_stats.thawed++;
+    glamor_priv->cold_stats.thaw_us += GetTimeInMicros() - start;
+    return TRUE;
+}
+
+/*
+ * Last resort for glamor_get_drawable_pixmap(), which has no way to
+ * fail: when a pixmap can't be thawed, throw its contents away and
+ * give it cleared storage instead of handing out a pixmap with none.
+ * Returns FALSE, leaving it compressed, if even that can't be had.
+ */
+Bool
+glamor_cold_discard(PixmapPtr pixmap)
+{
+    ScreenPtr screen = pixmap->drawable.pScreen;
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_pixmap_private *priv = glamor_get_pixmap_private(pixmap);
+    char *packed = priv->cold_data;
+    uint8_t *raw;
+
+    if (!packed)
+        return TRUE;
+
+    /* Clear this first, ensure_fbo thaws too */
+    priv->cold_data = NULL;
+
+    glamor_make_current(glamor_priv);
+
+    if (glamor_pixmap_ensure_fbo(pixmap, gl_iformat_for_pixmap(pixmap), 0)) {
+        glamor_solid(pixmap, 0, 0,
+                     pixmap->drawable.width, pixmap->drawable.height, 0);
+    } else {
+        raw = calloc(1, pixmap->devKind * pixmap->drawable.height);
+        if (!raw) {
+            priv->cold_data = packed;
+            return FALSE;
+        }
+        priv->type = GLAMOR_MEMORY;
+        priv->cold_owned = raw;
+        pixmap->devPrivate.ptr = raw;
+    }
+    free(packed);
+
+    LogMessageVerb(X_ERROR, 0,
+                   "glamor: couldn't restore cold pixmap, contents lost\n");
+    return TRUE;
+}
+
+/*
+ * Compress pixmaps idle for longer than the timeout. With force set,
+ * everything eligible is compressed regardless of age; that is used
+ * under memory pressure. Only to be called between requests, from
+ * the block handler or the idle scheduler. Returns the number of
+ * pixmaps compressed.
+ */
+int
+glamor_cold_reclaim(ScreenPtr screen, Bool force)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_pixmap_private *priv, *tmp;
+    int n = 0;
+
+    if (!glamor_priv->cold_timeout)
+        return 0;
+
+    glamor_cold_epoch = GetTimeInMillis() / 1000;
+
+    xorg_list_for_each_entry_safe(priv, tmp, &glamor_priv->cold_pixmaps,
+                                  cold_link) {
+        if (!force && n >= GLAMOR_COLD_MAX_PER_SCAN)
+            break;
+
+        if (!force &&
+            glamor_cold_epoch - priv->cold_epoch < glamor_priv->cold_timeout)
+            continue;
+
+        if (glamor_cold_freeze(screen, priv))
+            n++;
+    }
+    return n;
+}
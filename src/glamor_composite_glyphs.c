@@ -565,6 +565,28 @@ glamor_free_glyph_atlas(struct glamor_glyph_atlas *atlas)
     free (atlas);
 }
 
+/*
+ * Free the glyph atlases under memory pressure. Bumping the serials
+ * makes every glyph be uploaded again into fresh atlases.
+ */
+void
+glamor_composite_glyphs_trim(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    struct glamor_glyph_atlas *atlases[2] = {
+        glamor_priv->glyph_atlas_a, glamor_priv->glyph_atlas_argb
+    };
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(atlases); i++) {
+        if (!atlases[i] || !atlases[i]->atlas)
+            continue;
+        (*screen->DestroyPixmap)(atlases[i]->atlas);
+        atlases[i]->atlas = NULL;
+        atlases[i]->serial++;
+    }
+}
+
 void
 glamor_composite_glyphs_fini(ScreenPtr screen)
 {
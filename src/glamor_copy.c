@@ -215,6 +215,9 @@ glamor_copy_cpu_fbo(DrawablePtr src,
     if (gc && !glamor_pm_is_solid(gc->depth, gc->planemask))
         goto bail;
 
+    if (!glamor_pixmap_unshare(dst_pixmap))
+        goto bail;
+
     glamor_make_current(glamor_priv);
     glamor_prepare_access(src, GLAMOR_ACCESS_RO);
 
@@ -620,6 +623,87 @@ glamor_copy_needs_temp(DrawablePtr src,
     return FALSE;
 }
 
+/*
+ * A copy of all of one pixmap onto another of the same size and
+ * format, as when duplicating or snapshotting a pixmap, just points
+ * the destination at the source FBO. Whichever of them is drawn to
+ * next gets a copy of its own then, in glamor_pixmap_unshare_fbo().
+ */
+static Bool
+glamor_copy_share_fbo(DrawablePtr src,
+                      DrawablePtr dst,
+                      GCPtr gc,
+                      BoxPtr box,
+                      int nbox,
+                      int dx,
+                      int dy,
+                      Pixel bitplane)
+{
+    ScreenPtr screen = dst->pScreen;
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    PixmapPtr src_pixmap = glamor_get_drawable_pixmap(src);
+    PixmapPtr dst_pixmap = glamor_get_drawable_pixmap(dst);
+    glamor_pixmap_private *src_priv = glamor_get_pixmap_private(src_pixmap);
+    glamor_pixmap_private *dst_priv = glamor_get_pixmap_private(dst_pixmap);
+    int width = dst_pixmap->drawable.width;
+    int height = dst_pixmap->drawable.height;
+    int src_off_x, src_off_y, dst_off_x, dst_off_y;
+    uint64_t area = 0;
+    int n;
+
+    if (bitplane || src_pixmap == dst_pixmap)
+        return FALSE;
+
+    if (gc && (gc->alu != GXcopy ||
+               !glamor_pm_is_solid(gc->depth, gc->planemask)))
+        return FALSE;
+
+    /* Pixmaps shared with anyone outside of glamor keep their own
+     * storage.
+     */
+    if (src_priv->type != GLAMOR_TEXTURE_ONLY ||
+        dst_priv->type != GLAMOR_TEXTURE_ONLY ||
+        glamor_pixmap_priv_is_large(src_priv) ||
+        glamor_pixmap_priv_is_large(dst_priv) ||
+        src_priv->prepared || dst_priv->prepared)
+        return FALSE;
+
+    if (src_pixmap->drawable.width != width ||
+        src_pixmap->drawable.height != height ||
+        src_pixmap->drawable.depth != dst_pixmap->drawable.depth ||
+        src_priv->fbo->format != dst_priv->fbo->format ||
+        !src_priv->fbo->fb || !dst_priv->fbo->fb)
+        return FALSE;
+
+    glamor_get_drawable_deltas(src, src_pixmap, &src_off_x, &src_off_y);
+    glamor_get_drawable_deltas(dst, dst_pixmap, &dst_off_x, &dst_off_y);
+    if (dx + src_off_x != dst_off_x || dy + src_off_y != dst_off_y)
+        return FALSE;
+
+    /* The boxes come from a region, so they don't overlap and cover
+     * the pixmap exactly when their areas add up to it.
+     */
+    for (n = 0; n < nbox; n++) {
+        int x1 = MAX(box[n].x1 + dst_off_x, 0);
+        int y1 = MAX(box[n].y1 + dst_off_y, 0);
+        int x2 = MIN(box[n].x2 + dst_off_x, width);
+        int y2 = MIN(box[n].y2 + dst_off_y, height);
+
+        if (x1 < x2 && y1 < y2)
+            area += (uint64_t) (x2 - x1) * (y2 - y1);
+    }
+    if (area != (uint64_t) width * height)
+        return FALSE;
+
+    if (src_priv->fbo != dst_priv->fbo) {
+        glamor_pixmap_destroy_fbo(dst_pixmap);
+        src_priv->fbo->shared++;
+        glamor_pixmap_attach_fbo(dst_pixmap, src_priv->fbo);
+        glamor_priv->fbo_shares++;
+    }
+    return TRUE;
+}
+
 static Bool
 glamor_copy_gl(DrawablePtr src,
                DrawablePtr dst,
@@ -640,6 +724,8 @@ glamor_copy_gl(DrawablePtr src,
 
     if (GLAMOR_PIXMAP_PRIV_HAS_FBO(dst_priv)) {
         if (GLAMOR_PIXMAP_PRIV_HAS_FBO(src_priv)) {
+            if (glamor_copy_share_fbo(src, dst, gc, box, nbox, dx, dy, bitplane))
+                return TRUE;
             if (glamor_copy_needs_temp(src, dst, box, nbox, dx, dy))
                 return glamor_copy_fbo_fbo_temp(src, dst, gc, box, nbox, dx, dy,
                                                 reverse, upsidedown, bitplane, closure);
@@ -672,12 +758,31 @@ glamor_copy(DrawablePtr src,
             Pixel bitplane,
             void *closure)
 {
+    glamor_dispatch dispatch;
+    glamor_verify verify;
+    uint64_t area = 0;
+    int n;
+
     if (nbox == 0)
 	return;
 
-    if (glamor_copy_gl(src, dst, gc, box, nbox, dx, dy, reverse, upsidedown, bitplane, closure))
+    for (n = 0; n < nbox; n++)
+        area += (uint64_t) (box[n].x2 - box[n].x1) * (box[n].y2 - box[n].y1);
+
+    glamor_trace_begin(GLAMOR_TRACE_COPY, nbox, MIN(area, INT32_MAX));
+    glamor_verify_begin(dst, box, nbox, &verify);
+    if (glamor_dispatch_begin(&dispatch, GLAMOR_DISPATCH_COPY,
+                              dst, src, area) &&
+        glamor_copy_gl(src, dst, gc, box, nbox, dx, dy, reverse, upsidedown, bitplane, closure) &&
+        !glamor_verify_check(&verify)) {
+        glamor_dispatch_end(&dispatch, TRUE);
+        glamor_trace_end(GLAMOR_TRACE_COPY);
         return;
+    }
     glamor_copy_bail(src, dst, gc, box, nbox, dx, dy, reverse, upsidedown, bitplane, closure);
+    glamor_dispatch_end(&dispatch, FALSE);
+    glamor_verify_end(&verify, "copy");
+    glamor_trace_end(GLAMOR_TRACE_COPY);
 }
 
 RegionPtr
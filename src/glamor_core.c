@@ -56,10 +56,12 @@ glamor_compile_glsl_prog(GLenum type, const char *source)
     GLint ok;
     GLint prog;
 
+    glamor_trace_begin(GLAMOR_TRACE_COMPILE, strlen(source), 0);
     prog = glCreateShader(type);
     glShaderSource(prog, 1, (const GLchar **) &source, NULL);
     glCompileShader(prog);
     glGetShaderiv(prog, GL_COMPILE_STATUS, &ok);
+    glamor_trace_end(GLAMOR_TRACE_COMPILE);
     if (!ok) {
         GLchar *info;
         GLint size;
@@ -98,8 +100,10 @@ glamor_link_glsl_prog(ScreenPtr screen, GLint prog, const char *format, ...)
         va_end(va);
     }
 
+    glamor_trace_begin(GLAMOR_TRACE_LINK, 0, 0);
     glLinkProgram(prog);
     glGetProgramiv(prog, GL_LINK_STATUS, &ok);
+    glamor_trace_end(GLAMOR_TRACE_LINK);
     if (!ok) {
         GLchar *info;
         GLint size;
@@ -238,7 +242,7 @@ glamor_validate_gc(GCPtr gc, unsigned long changes, DrawablePtr drawable)
     }
 #endif
     if (changes & GCTile) {
-        if (!gc->tileIsPixel) {
+        if (!gc->tileIsPixel && glamor_pixmap_thaw(gc->tile.pixmap)) {
             glamor_pixmap_private *pixmap_priv =
                 glamor_get_pixmap_private(gc->tile.pixmap);
             if ((!GLAMOR_PIXMAP_PRIV_HAS_FBO(pixmap_priv))
@@ -284,6 +288,9 @@ glamor_validate_gc(GCPtr gc, unsigned long changes, DrawablePtr drawable)
         }
     }
 
+    /* Read back ahead of fallbacks this GC is bound to cause */
+    glamor_prefetch_gc(gc, drawable);
+
     gc->ops = &glamor_gc_ops;
 }
 
@@ -334,8 +341,20 @@ glamor_create_gc(GCPtr gc)
 RegionPtr
 glamor_bitmap_to_region(PixmapPtr pixmap)
 {
+    glamor_pixmap_private *pixmap_priv = glamor_get_pixmap_private(pixmap);
     RegionPtr ret;
 
+    if (!glamor_pixmap_thaw(pixmap))
+        return NULL;
+
+    /* Memory bitmaps need no readback at all */
+    if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(pixmap_priv))
+        return fbPixmapToRegion(pixmap);
+
+    ret = glamor_bitmap_to_region_gl(pixmap);
+    if (ret)
+        return ret;
+
     glamor_fallback("pixmap %p \n", pixmap);
     if (!glamor_prepare_access(&pixmap->drawable, GLAMOR_ACCESS_RO))
         return NULL;
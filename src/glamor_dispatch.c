@@ -0,0 +1,214 @@
+/*
+ * Copyright © 2014 Keith Packard
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include "glamor_priv.h"
+
+/*
+ * Pick between the GL and fb paths by measuring them.
+ *
+ * Operations with both a GL path and an fb fallback are sorted into
+ * buckets by operation, size and whether the pixmaps involved are
+ * on the GPU. The first calls in each bucket time both paths, with
+ * the GPU drained before and after so that only the operation itself
+ * is counted; after that calls go to whichever path has been
+ * faster, and every GLAMOR_DISPATCH_REPROBE calls the other path is
+ * timed again in case things have changed. On most GPUs everything
+ * ends up on the GL path; software renderers and small operations
+ * are where fb wins.
+ *
+ * A bucket whose GL path gave up during a probe is never timed again:
+ * GL is still tried first, untimed, and bails to the fallback without
+ * stalling the GPU each time to find out.
+ *
+ * Callers look like
+ *
+ *      if (glamor_dispatch_begin(&dispatch, op, dst, src, area) &&
+ *          glamor_foo_gl(...)) {
+ *          glamor_dispatch_end(&dispatch, TRUE);
+ *          return;
+ *      }
+ *      glamor_foo_bail(...);
+ *      glamor_dispatch_end(&dispatch, FALSE);
+ *
+ * GLAMOR_NO_AUTO_DISPATCH always tries GL first, as does GLAMOR_VERIFY.
+ */
+
+/* Timings of each path taken before trusting the averages */
+#define GLAMOR_DISPATCH_MIN_SAMPLES     4
+
+/* Calls between timing the path not being used */
+#define GLAMOR_DISPATCH_REPROBE         1024
+
+enum {
+    GLAMOR_DISPATCH_PROBE_NONE,
+    GLAMOR_DISPATCH_PROBE_GL,
+    GLAMOR_DISPATCH_PROBE_FB,
+};
+
+void
+glamor_dispatch_init(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+
+    glamor_priv->dispatch_enabled = !glamor_priv->verify_interval &&
+        !getenv("GLAMOR_NO_AUTO_DISPATCH");
+}
+
+void
+glamor_dispatch_fini(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+
+    if (glamor_priv->dispatch_probes)
+        LogMessageVerb(X_INFO, 3,
+                       "glamor%d: dispatch: %lu timed, %lu sent to fb\n",
+                       screen->myNum, glamor_priv->dispatch_probes,
+                       glamor_priv->dispatch_fb);
+}
+
+static int
+glamor_dispatch_size(uint64_t area)
+{
+    int size = 0;
+
+    /* Powers of four from 16 pixels up */
+    while (area >= 16 && size < GLAMOR_DISPATCH_SIZES - 1) {
+        area >>= 2;
+        size++;
+    }
+    return size;
+}
+
+/*
+ * Fold a new time, in microseconds, into an average kept in 1/16us
+ */
+static void
+glamor_dispatch_sample(uint32_t *average, uint16_t *samples, CARD64 us)
+{
+    uint32_t scaled = MIN(us, UINT32_MAX >> 5) << 4;
+
+    if (!*samples)
+        *average = scaled;
+    else
+        *average = *average - (*average >> 3) + (scaled >> 3);
+    if (*samples < UINT16_MAX)
+        (*samples)++;
+}
+
+/*
+ * Returns TRUE when the GL path should be tried. 'area' is the number
+ * of pixels the operation touches; 'src' may be NULL.
+ */
+Bool
+glamor_dispatch_begin(glamor_dispatch *dispatch, glamor_dispatch_op op,
+                      DrawablePtr dst, DrawablePtr src, uint64_t area)
+{
+    glamor_screen_private *glamor_priv =
+        glamor_get_screen_private(dst->pScreen);
+    glamor_dispatch_bucket *bucket;
+    int residency;
+
+    dispatch->probe = GLAMOR_DISPATCH_PROBE_NONE;
+
+    if (!glamor_priv->dispatch_enabled)
+        return TRUE;
+
+    /* Without a destination FBO, GL gives up straight away */
+    if (!glamor_pixmap_has_fbo(glamor_get_drawable_pixmap(dst)))
+        return TRUE;
+
+    residency = 1;
+    if (src && glamor_pixmap_has_fbo(glamor_get_drawable_pixmap(src)))
+        residency |= 2;
+
+    bucket = &glamor_priv->dispatch[op][glamor_dispatch_size(area)][residency];
+    bucket->calls++;
+
+    if (bucket->gl_failed)
+        return TRUE;
+
+    if (bucket->gl_samples < GLAMOR_DISPATCH_MIN_SAMPLES)
+        dispatch->probe = GLAMOR_DISPATCH_PROBE_GL;
+    else if (bucket->fb_samples < GLAMOR_DISPATCH_MIN_SAMPLES)
+        dispatch->probe = GLAMOR_DISPATCH_PROBE_FB;
+    else if (bucket->calls % GLAMOR_DISPATCH_REPROBE == 0)
+        dispatch->probe = bucket->use_fb ? GLAMOR_DISPATCH_PROBE_GL :
+            GLAMOR_DISPATCH_PROBE_FB;
+
+    if (dispatch->probe == GLAMOR_DISPATCH_PROBE_NONE) {
+        if (!bucket->use_fb)
+            return TRUE;
+        glamor_priv->dispatch_fb++;
+        return FALSE;
+    }
+
+    /* Time only this operation */
+    glamor_make_current(glamor_priv);
+    glFinish();
+
+    dispatch->glamor_priv = glamor_priv;
+    dispatch->bucket = bucket;
+    dispatch->start = GetTimeInMicros();
+    glamor_priv->dispatch_probes++;
+    return dispatch->probe == GLAMOR_DISPATCH_PROBE_GL;
+}
+
+/*
+ * Called once the operation is done; 'gl' says whether the GL path
+ * did it.
+ */
+void
+glamor_dispatch_end(glamor_dispatch *dispatch, Bool gl)
+{
+    glamor_dispatch_bucket *bucket = dispatch->bucket;
+    CARD64 us;
+
+    if (dispatch->probe == GLAMOR_DISPATCH_PROBE_NONE)
+        return;
+
+    if (dispatch->probe == GLAMOR_DISPATCH_PROBE_GL && !gl) {
+        /* GL can't do this one; don't keep stalling to find out */
+        bucket->gl_failed = TRUE;
+        return;
+    }
+
+    glamor_make_current(dispatch->glamor_priv);
+    glFinish();
+    us = GetTimeInMicros() - dispatch->start;
+
+    if (gl)
+        glamor_dispatch_sample(&bucket->gl_time, &bucket->gl_samples, us);
+    else
+        glamor_dispatch_sample(&bucket->fb_time, &bucket->fb_samples, us);
+
+    if (bucket->gl_samples < GLAMOR_DISPATCH_MIN_SAMPLES ||
+        bucket->fb_samples < GLAMOR_DISPATCH_MIN_SAMPLES)
+        return;
+
+    /* Only switch for a clear win */
+    if (bucket->use_fb)
+        bucket->use_fb = !((uint64_t) bucket->gl_time * 4 <
+                           (uint64_t) bucket->fb_time * 3);
+    else
+        bucket->use_fb = (uint64_t) bucket->fb_time * 4 <
+            (uint64_t) bucket->gl_time * 3;
+}
@@ -59,6 +59,24 @@ glamor_identify(int flags)
             glamor_name);
 }
 
+/* Imported dma-bufs whose EGLImages are kept around for reuse */
+#define GLAMOR_EGL_IMAGE_CACHE_SIZE     8
+
+/* Milliseconds an image no pixmap uses keeps the client's buffer */
+#define GLAMOR_EGL_IMAGE_CACHE_TIMEOUT  5000
+
+struct glamor_egl_image_cache_entry {
+    uint32_t handle;
+    int width, height, stride;
+    int depth, bpp;
+    uint32_t format;
+    struct gbm_bo *bo;
+    EGLImageKHR image;
+    int users;
+    unsigned int last_use;
+    CARD32 idle_since;          /**< when users dropped to 0 */
+};
+
 struct glamor_egl_screen_private {
     EGLDisplay display;
     EGLContext context;
@@ -75,6 +93,13 @@ struct glamor_egl_screen_private {
     int dri3_capable;
 	int dmabuf_capable;
 
+    struct glamor_egl_image_cache_entry
+        image_cache[GLAMOR_EGL_IMAGE_CACHE_SIZE];
+    unsigned int image_cache_clock;
+    unsigned long image_cache_hits;
+    unsigned long image_cache_misses;
+    Bool image_cache_task;      /**< expiry registered with the idle scheduler */
+
     CloseScreenProcPtr saved_close_screen;
     DestroyPixmapProcPtr saved_destroy_pixmap;
     xf86FreeScreenProc *saved_free_screen;
@@ -90,6 +115,9 @@ glamor_egl_get_screen_private(ScrnInfoPtr scrn)
         scrn->privates[xf86GlamorEGLPrivateIndex].ptr;
 }
 
+/* The glamor context EGL was last asked to make current */
+static struct glamor_context *glamor_egl_current;
+
 static void
 glamor_egl_make_current(struct glamor_context *glamor_ctx)
 {
@@ -98,15 +126,22 @@ glamor_egl_make_current(struct glamor_context *glamor_ctx)
      * each other.  We need to set the context to NULL first to avoid
      * EGL's no-op context change fast path when switching back to
      * EGL.
+     *
+     * That is only needed when someone else has been current since
+     * we last switched.  Going from one glamor screen to another
+     * (multiple screens or PRIME) leaves EGL's idea of the current
+     * context accurate, so a single switch is enough.
      */
-    eglMakeCurrent(glamor_ctx->display, EGL_NO_SURFACE,
-                   EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (!lastGLContext || lastGLContext != glamor_egl_current)
+        eglMakeCurrent(glamor_ctx->display, EGL_NO_SURFACE,
+                       EGL_NO_SURFACE, EGL_NO_CONTEXT);
 
     if (!eglMakeCurrent(glamor_ctx->display,
                         EGL_NO_SURFACE, EGL_NO_SURFACE,
                         glamor_ctx->ctx)) {
         FatalError("Failed to make EGL context current\n");
     }
+    glamor_egl_current = glamor_ctx;
 }
 
 static EGLImageKHR
@@ -223,6 +258,32 @@ glamor_egl_check_has_gem(int fd)
     return FALSE;
 }
 
+/*
+ * Drop a pixmap's reference to an EGLImage. Images from the import
+ * cache stay alive for the next import of the same buffer.
+ */
+static void
+glamor_egl_release_image(struct glamor_egl_screen_private *glamor_egl,
+                         EGLImageKHR image)
+{
+    int i;
+
+    if (!image)
+        return;
+
+    for (i = 0; i < GLAMOR_EGL_IMAGE_CACHE_SIZE; i++) {
+        struct glamor_egl_image_cache_entry *entry =
+            &glamor_egl->image_cache[i];
+
+        if (entry->image == image) {
+            if (--entry->users == 0)
+                entry->idle_since = GetTimeInMillis();
+            return;
+        }
+    }
+    eglDestroyImageKHR(glamor_egl->display, image);
+}
+
 static void
 glamor_egl_set_pixmap_image(PixmapPtr pixmap, EGLImageKHR image)
 {
@@ -236,7 +297,7 @@ glamor_egl_set_pixmap_image(PixmapPtr pixmap, EGLImageKHR image)
         ScrnInfoPtr                             scrn = xf86ScreenToScrn(screen);
         struct glamor_egl_screen_private        *glamor_egl = glamor_egl_get_screen_private(scrn);
 
-        eglDestroyImageKHR(glamor_egl->display, old);
+        glamor_egl_release_image(glamor_egl, old);
     }
     pixmap_priv->image = image;
 }
@@ -289,6 +350,25 @@ glamor_egl_create_textured_pixmap(PixmapPtr pixmap, int handle, int stride)
     return ret;
 }
 
+#ifdef GLAMOR_HAS_GBM
+static void
+glamor_egl_set_pixmap_bo_image(PixmapPtr pixmap, struct gbm_bo *bo,
+                               EGLImageKHR image)
+{
+    struct glamor_pixmap_private *pixmap_priv =
+        glamor_get_pixmap_private(pixmap);
+    GLuint texture;
+
+    glamor_create_texture_from_image(pixmap->drawable.pScreen,
+                                     image, &texture);
+    pixmap_priv->bo = bo;
+    gbm_bo_ref(bo);
+    glamor_set_pixmap_type(pixmap, GLAMOR_TEXTURE_DRM);
+    glamor_set_pixmap_texture(pixmap, texture);
+    glamor_egl_set_pixmap_image(pixmap, image);
+}
+#endif
+
 Bool
 glamor_egl_create_textured_pixmap_from_gbm_bo(PixmapPtr pixmap,
                                               struct gbm_bo *bo)
@@ -302,7 +382,6 @@ glamor_egl_create_textured_pixmap_from_gbm_bo(PixmapPtr pixmap,
         glamor_get_pixmap_private(pixmap);
     struct glamor_egl_screen_private *glamor_egl;
     EGLImageKHR image;
-    GLuint texture;
     Bool ret = FALSE;
 
     if (pixmap_priv->bo)
@@ -318,12 +397,7 @@ glamor_egl_create_textured_pixmap_from_gbm_bo(PixmapPtr pixmap,
         glamor_set_pixmap_type(pixmap, GLAMOR_DRM_ONLY);
         goto done;
     }
-    glamor_create_texture_from_image(screen, image, &texture);
-    pixmap_priv->bo = bo;
-    gbm_bo_ref(bo);
-    glamor_set_pixmap_type(pixmap, GLAMOR_TEXTURE_DRM);
-    glamor_set_pixmap_texture(pixmap, texture);
-    glamor_egl_set_pixmap_image(pixmap, image);
+    glamor_egl_set_pixmap_bo_image(pixmap, bo, image);
     ret = TRUE;
 
  done:
@@ -333,6 +407,159 @@ glamor_egl_create_textured_pixmap_from_gbm_bo(PixmapPtr pixmap,
 #endif
 }
 
+#ifdef GLAMOR_HAS_GBM
+static void
+glamor_egl_image_cache_drop(struct glamor_egl_screen_private *glamor_egl,
+                            struct glamor_egl_image_cache_entry *entry)
+{
+    eglDestroyImageKHR(glamor_egl->display, entry->image);
+    gbm_bo_unref(entry->bo);
+    entry->image = NULL;
+    entry->bo = NULL;
+}
+
+/*
+ * Let go of one image no pixmap has used for
+ * GLAMOR_EGL_IMAGE_CACHE_TIMEOUT, and with it the client's buffer,
+ * which it may long have closed. Run by the idle scheduler, or on
+ * imports and pixmap destruction when that is disabled.
+ */
+static Bool
+glamor_egl_image_cache_expire(ScreenPtr screen)
+{
+    struct glamor_egl_screen_private *glamor_egl =
+        glamor_egl_get_screen_private(xf86ScreenToScrn(screen));
+    CARD32 now = GetTimeInMillis();
+    int i;
+
+    for (i = 0; i < GLAMOR_EGL_IMAGE_CACHE_SIZE; i++) {
+        struct glamor_egl_image_cache_entry *entry =
+            &glamor_egl->image_cache[i];
+
+        if (entry->image && entry->users == 0 &&
+            (int) (now - entry->idle_since) >= GLAMOR_EGL_IMAGE_CACHE_TIMEOUT) {
+            glamor_egl_image_cache_drop(glamor_egl, entry);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*
+ * Import a dma-buf through the EGLImage cache.
+ *
+ * PRIME sinks and DRI3 clients hand us the same few buffers over and
+ * over. Importing resolves to the GEM handle we already hold for a
+ * buffer, so that identifies it along with the layout and format it
+ * is imported with, and a cache hit only costs a new texture instead
+ * of a new EGLImage.
+ */
+static Bool
+glamor_egl_create_textured_pixmap_from_import(PixmapPtr pixmap,
+                                              struct gbm_bo *bo)
+{
+    ScreenPtr screen = pixmap->drawable.pScreen;
+    struct glamor_egl_screen_private *glamor_egl =
+        glamor_egl_get_screen_private(xf86ScreenToScrn(screen));
+    struct glamor_pixmap_private *pixmap_priv =
+        glamor_get_pixmap_private(pixmap);
+    struct glamor_egl_image_cache_entry *entry, *victim = NULL;
+    uint32_t handle = gbm_bo_get_handle(bo).u32;
+    uint32_t format = gbm_bo_get_format(bo);
+    EGLImageKHR image;
+    int i;
+
+    if (!glamor_egl->image_cache_task)
+        glamor_egl->image_cache_task =
+            glamor_idle_add_task(screen, "dma-buf images",
+                                 glamor_egl_image_cache_expire, 200);
+    if (!glamor_egl->image_cache_task) {
+        while (glamor_egl_image_cache_expire(screen))
+            ;
+    }
+
+    for (i = 0; i < GLAMOR_EGL_IMAGE_CACHE_SIZE; i++) {
+        entry = &glamor_egl->image_cache[i];
+
+        if (entry->image && entry->handle == handle &&
+            entry->width == pixmap->drawable.width &&
+            entry->height == pixmap->drawable.height &&
+            entry->stride == pixmap->devKind &&
+            entry->depth == pixmap->drawable.depth &&
+            entry->bpp == pixmap->drawable.bitsPerPixel &&
+            entry->format == format) {
+            if (pixmap_priv->bo)
+                gbm_bo_unref(pixmap_priv->bo);
+            glamor_make_current(glamor_get_screen_private(screen));
+            entry->users++;
+            entry->last_use = ++glamor_egl->image_cache_clock;
+            glamor_egl->image_cache_hits++;
+            glamor_egl_set_pixmap_bo_image(pixmap, entry->bo, entry->image);
+            return TRUE;
+        }
+
+        /* Only images no pixmap is using can be replaced */
+        if (entry->users == 0 &&
+            (!victim || !entry->image ||
+             (victim->image && entry->last_use < victim->last_use)))
+            victim = entry;
+    }
+
+    glamor_egl->image_cache_misses++;
+
+    if (!glamor_egl_create_textured_pixmap_from_gbm_bo(pixmap, bo))
+        return FALSE;
+
+    if (!victim)
+        return TRUE;
+
+    /* Hand the image over to the cache; it keeps its own bo reference */
+    image = pixmap_priv->image;
+    if (victim->image)
+        glamor_egl_image_cache_drop(glamor_egl, victim);
+    victim->handle = handle;
+    victim->width = pixmap->drawable.width;
+    victim->height = pixmap->drawable.height;
+    victim->stride = pixmap->devKind;
+    victim->depth = pixmap->drawable.depth;
+    victim->bpp = pixmap->drawable.bitsPerPixel;
+    victim->format = format;
+    victim->bo = bo;
+    gbm_bo_ref(bo);
+    victim->image = image;
+    victim->users = 1;
+    victim->last_use = ++glamor_egl->image_cache_clock;
+    return TRUE;
+}
+
+static void
+glamor_egl_image_cache_fini(ScrnInfoPtr scrn,
+                            struct glamor_egl_screen_private *glamor_egl)
+{
+    int i;
+
+    for (i = 0; i < GLAMOR_EGL_IMAGE_CACHE_SIZE; i++) {
+        struct glamor_egl_image_cache_entry *entry =
+            &glamor_egl->image_cache[i];
+
+        if (!entry->image)
+            continue;
+        /* Images still in use now belong to their pixmaps */
+        if (entry->users == 0)
+            eglDestroyImageKHR(glamor_egl->display, entry->image);
+        gbm_bo_unref(entry->bo);
+        entry->image = NULL;
+        entry->bo = NULL;
+    }
+
+    if (glamor_egl->image_cache_hits || glamor_egl->image_cache_misses)
+        xf86DrvMsgVerb(scrn->scrnIndex, X_INFO, 3,
+                       "glamor: dma-buf image cache: %lu hits, %lu misses\n",
+                       glamor_egl->image_cache_hits,
+                       glamor_egl->image_cache_misses);
+}
+#endif
+
 #ifdef GLAMOR_HAS_GBM
 static void
 glamor_get_name_from_bo(int gbm_fd, struct gbm_bo *bo, int *name)
@@ -364,6 +591,13 @@ glamor_make_pixmap_exportable(PixmapPtr pixmap)
     if (pixmap_priv->image)
         return TRUE;
 
+    if (!glamor_pixmap_thaw(pixmap))
+        return FALSE;
+
+    /* Nothing to allocate shareable buffers from when headless */
+    if (!glamor_egl->gbm)
+        return FALSE;
+
     if (pixmap->drawable.bitsPerPixel != 32) {
         xf86DrvMsg(scrn->scrnIndex, X_ERROR,
                    "Failed to make %dbpp pixmap exportable\n",
@@ -510,7 +744,7 @@ glamor_back_pixmap_from_fd(PixmapPtr pixmap,
 
     screen->ModifyPixmapHeader(pixmap, width, height, 0, 0, stride, NULL);
 
-    ret = glamor_egl_create_textured_pixmap_from_gbm_bo(pixmap, bo);
+    ret = glamor_egl_create_textured_pixmap_from_import(pixmap, bo);
     gbm_bo_destroy(bo);
     return ret;
 #else
@@ -556,11 +790,13 @@ glamor_egl_destroy_pixmap(PixmapPtr pixmap)
             glamor_get_pixmap_private(pixmap);
 
         if (pixmap_priv->image)
-            eglDestroyImageKHR(glamor_egl->display, pixmap_priv->image);
+            glamor_egl_release_image(glamor_egl, pixmap_priv->image);
 
 #ifdef GLAMOR_HAS_GBM
         if (pixmap_priv->bo)
 		    gbm_bo_destroy(pixmap_priv->bo);
+        if (!glamor_egl->image_cache_task)
+            glamor_egl_image_cache_expire(screen);
 #endif
     }
 
@@ -608,8 +844,11 @@ glamor_egl_close_screen(ScreenPtr screen)
     screen_pixmap = screen->GetScreenPixmap(screen);
     pixmap_priv = glamor_get_pixmap_private(screen_pixmap);
 
-    eglDestroyImageKHR(glamor_egl->display, pixmap_priv->image);
+    glamor_egl_release_image(glamor_egl, pixmap_priv->image);
     pixmap_priv->image = NULL;
+#ifdef GLAMOR_HAS_GBM
+    glamor_egl_image_cache_fini(scrn, glamor_egl);
+#endif
 
     screen->CloseScreen = glamor_egl->saved_close_screen;
 
@@ -731,6 +970,9 @@ static void glamor_egl_cleanup(struct glamor_egl_screen_private *glamor_egl)
          * (on hot unplug another GPU may still be using glamor)
          */
         lastGLContext = NULL;
+        if (glamor_egl_current &&
+            glamor_egl_current->display == glamor_egl->display)
+            glamor_egl_current = NULL;
         eglTerminate(glamor_egl->display);
     }
 #ifdef GLAMOR_HAS_GBM
@@ -754,6 +996,49 @@ glamor_egl_free_screen(ScrnInfoPtr scrn)
     }
 }
 
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA   0x31DD
+#endif
+#ifndef EGL_PLATFORM_DEVICE_EXT
+#define EGL_PLATFORM_DEVICE_EXT         0x313F
+#endif
+
+/*
+ * Find a display that doesn't need a DRM device: Mesa's surfaceless
+ * platform when available, otherwise the first EGL device.
+ */
+static EGLDisplay
+glamor_egl_get_headless_display(void)
+{
+    if (epoxy_has_egl_extension(NULL, "EGL_MESA_platform_surfaceless"))
+        return glamor_egl_get_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                      EGL_DEFAULT_DISPLAY);
+
+    if (epoxy_has_egl_extension(NULL, "EGL_EXT_platform_device") &&
+        epoxy_has_egl_extension(NULL, "EGL_EXT_device_enumeration")) {
+        PFNEGLQUERYDEVICESEXTPROC queryDevicesEXT =
+            (void *) eglGetProcAddress("eglQueryDevicesEXT");
+        EGLDeviceEXT device;
+        EGLint ndevice;
+
+        if (queryDevicesEXT && queryDevicesEXT(1, &device, &ndevice) &&
+            ndevice == 1)
+            return glamor_egl_get_display(EGL_PLATFORM_DEVICE_EXT, device);
+    }
+
+    return EGL_NO_DISPLAY;
+}
+
+/*
+ * Software renderers are slower than fb for most of what X does, so
+ * they are only used when asked for.
+ */
+static Bool
+glamor_egl_renderer_is_software(const char *renderer)
+{
+    return strstr(renderer, "llvmpipe") || strstr(renderer, "softpipe");
+}
+
 Bool
 glamor_egl_init(ScrnInfoPtr scrn, int fd)
 {
@@ -770,14 +1055,19 @@ glamor_egl_init(ScrnInfoPtr scrn, int fd)
 
     scrn->privates[xf86GlamorEGLPrivateIndex].ptr = glamor_egl;
     glamor_egl->fd = fd;
-    glamor_egl->gbm = gbm_create_device(glamor_egl->fd);
-    if (glamor_egl->gbm == NULL) {
-        ErrorF("couldn't get display device\n");
-        goto error;
-    }
+    if (fd < 0) {
+        /* Headless; no GBM, so no buffer sharing or DRI3 either */
+        glamor_egl->display = glamor_egl_get_headless_display();
+    } else {
+        glamor_egl->gbm = gbm_create_device(glamor_egl->fd);
+        if (glamor_egl->gbm == NULL) {
+            ErrorF("couldn't get display device\n");
+            goto error;
+        }
 
-    glamor_egl->display = glamor_egl_get_display(EGL_PLATFORM_GBM_MESA,
-                                                 glamor_egl->gbm);
+        glamor_egl->display = glamor_egl_get_display(EGL_PLATFORM_GBM_MESA,
+                                                     glamor_egl->gbm);
+    }
     if (!glamor_egl->display) {
         xf86DrvMsg(scrn->scrnIndex, X_ERROR, "eglGetDisplay() failed\n");
         goto error;
@@ -892,9 +1182,11 @@ glamor_egl_init(ScrnInfoPtr scrn, int fd)
                    "glGetString() returned NULL, your GL is broken\n");
         goto error;
     }
-    if (strstr((const char *)renderer, "llvmpipe")) {
+    if (glamor_egl_renderer_is_software((const char *) renderer) &&
+        !getenv("GLAMOR_ALLOW_SOFTWARE")) {
         xf86DrvMsg(scrn->scrnIndex, X_INFO,
-                   "Refusing to try glamor on llvmpipe\n");
+                   "Refusing to try glamor on %s, "
+                   "set GLAMOR_ALLOW_SOFTWARE to use it anyway\n", renderer);
         goto error;
     }
 
@@ -904,17 +1196,19 @@ glamor_egl_init(ScrnInfoPtr scrn, int fd)
      */
     lastGLContext = NULL;
 
-    if (!epoxy_has_gl_extension("GL_OES_EGL_image")) {
+    /* Only needed for sharing buffers through GBM */
+    if (glamor_egl->gbm && !epoxy_has_gl_extension("GL_OES_EGL_image")) {
         xf86DrvMsg(scrn->scrnIndex, X_ERROR,
                    "glamor acceleration requires GL_OES_EGL_image\n");
         goto error;
     }
 
-    xf86DrvMsg(scrn->scrnIndex, X_INFO, "glamor X acceleration enabled on %s\n",
-               renderer);
+    xf86DrvMsg(scrn->scrnIndex, X_INFO, "glamor X acceleration enabled on %s%s\n",
+               renderer, glamor_egl->gbm ? "" : " (headless)");
 
 #ifdef GBM_BO_WITH_MODIFIERS
-    if (epoxy_has_egl_extension(glamor_egl->display,
+    if (glamor_egl->gbm &&
+        epoxy_has_egl_extension(glamor_egl->display,
                                 "EGL_EXT_image_dma_buf_import") &&
         epoxy_has_egl_extension(glamor_egl->display,
                                 "EGL_EXT_image_dma_buf_import_modifiers")) {
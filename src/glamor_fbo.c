@@ -34,13 +34,20 @@ void
 glamor_destroy_fbo(glamor_screen_private *glamor_priv,
                    glamor_pixmap_fbo *fbo)
 {
+    if (fbo->shared) {
+        fbo->shared--;
+        return;
+    }
+
     glamor_make_current(glamor_priv);
 
+    glamor_stencil_fini_fbo(fbo);
     if (fbo->fb)
         glDeleteFramebuffers(1, &fbo->fb);
     if (fbo->tex)
         glDeleteTextures(1, &fbo->tex);
 
+    glamor_priv->mipmap_size -= fbo->mip_size;
     free(fbo);
 }
 
@@ -132,10 +139,21 @@ _glamor_create_tex(glamor_screen_private *glamor_priv,
     if (format == glamor_priv->one_channel_format && format == GL_RED)
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_A, GL_RED);
     glamor_priv->suppress_gl_out_of_memory_logging = true;
-    if (format == GL_RGBA)
-	    format = GL_BGRA;
-    glTexImage2D(GL_TEXTURE_2D, 0, format, w, h, 0,
-                 format, GL_UNSIGNED_BYTE, NULL);
+    if (format == GL_RGB) {
+        /* Desktop GL needs the sized format to really get 16bpp */
+        glTexImage2D(GL_TEXTURE_2D, 0,
+                     glamor_priv->gl_flavor == GLAMOR_GL_DESKTOP ?
+                     GL_RGB565 : GL_RGB, w, h, 0,
+                     GL_RGB, GL_UNSIGNED_SHORT_5_6_5, NULL);
+    } else if (format == GL_RGB10_A2) {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB10_A2, w, h, 0,
+                     GL_BGRA, GL_UNSIGNED_INT_2_10_10_10_REV, NULL);
+    } else {
+        if (format == GL_RGBA)
+            format = GL_BGRA;
+        glTexImage2D(GL_TEXTURE_2D, 0, format, w, h, 0,
+                     format, GL_UNSIGNED_BYTE, NULL);
+    }
     glamor_priv->suppress_gl_out_of_memory_logging = false;
 
     if (glGetError() == GL_OUT_OF_MEMORY) {
@@ -262,6 +280,7 @@ glamor_pixmap_attach_fbo(PixmapPtr pixmap, glamor_pixmap_fbo *fbo)
         return;
 
     pixmap_priv->fbo = fbo;
+    glamor_pixmap_invalidate(pixmap_priv);
 
     switch (pixmap_priv->type) {
     case GLAMOR_TEXTURE_ONLY:
@@ -296,6 +315,68 @@ glamor_pixmap_destroy_fbo(PixmapPtr pixmap)
     }
 }
 
+/*
+ * Give a pixmap sharing its FBO with others (see
+ * glamor_copy_share_fbo()) a copy of its own, before it gets written
+ * to. Areas in 'overwritten', in pixmap coordinates, are about to be
+ * replaced and aren't copied.
+ *
+ * This is called in the middle of setting up rendering, so it leaves
+ * the texture binding alone; the framebuffer binding is about to be
+ * replaced anyway. Returns FALSE, leaving the FBO shared, when there
+ * is no memory for the copy.
+ */
+Bool
+glamor_pixmap_unshare_fbo(PixmapPtr pixmap, RegionPtr overwritten)
+{
+    ScreenPtr screen = pixmap->drawable.pScreen;
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_pixmap_private *priv = glamor_get_pixmap_private(pixmap);
+    glamor_pixmap_fbo *shared = priv->fbo;
+    glamor_pixmap_fbo *fbo;
+    RegionRec region;
+    BoxRec box;
+    BoxPtr boxes;
+    GLint tex;
+    int nbox;
+
+    fbo = glamor_create_fbo(glamor_priv, shared->width, shared->height,
+                            shared->format, 0);
+    if (fbo == NULL)
+        return FALSE;
+
+    box.x1 = 0;
+    box.y1 = 0;
+    box.x2 = pixmap->drawable.width;
+    box.y2 = pixmap->drawable.height;
+    RegionInit(&region, &box, 1);
+    if (overwritten)
+        RegionSubtract(&region, &region, overwritten);
+
+    glamor_make_current(glamor_priv);
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &tex);
+    glBindTexture(GL_TEXTURE_2D, fbo->tex);
+    glBindFramebuffer(GL_FRAMEBUFFER, shared->fb);
+
+    boxes = RegionRects(&region);
+    nbox = RegionNumRects(&region);
+    while (nbox--) {
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, boxes->x1, boxes->y1,
+                            boxes->x1, boxes->y1,
+                            boxes->x2 - boxes->x1, boxes->y2 - boxes->y1);
+        boxes++;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, tex);
+    RegionUninit(&region);
+
+    glamor_pixmap_detach_fbo(priv);
+    shared->shared--;
+    glamor_pixmap_attach_fbo(pixmap, fbo);
+    glamor_priv->fbo_unshares++;
+    return TRUE;
+}
+
 Bool
 glamor_pixmap_ensure_fbo(PixmapPtr pixmap, GLenum format, int flag)
 {
@@ -304,6 +385,8 @@ glamor_pixmap_ensure_fbo(PixmapPtr pixmap, GLenum format, int flag)
     glamor_pixmap_fbo *fbo;
 
     glamor_priv = glamor_get_screen_private(pixmap->drawable.pScreen);
+    if (!glamor_pixmap_thaw(pixmap))
+        return FALSE;
     pixmap_priv = glamor_get_pixmap_private(pixmap);
     if (pixmap_priv->fbo == NULL) {
 
@@ -340,4 +423,6 @@ glamor_pixmap_exchange_fbos(PixmapPtr front, PixmapPtr back)
     temp_fbo = front_priv->fbo;
     front_priv->fbo = back_priv->fbo;
     back_priv->fbo = temp_fbo;
+    glamor_pixmap_invalidate(front_priv);
+    glamor_pixmap_invalidate(back_priv);
 }
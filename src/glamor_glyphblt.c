@@ -145,13 +145,40 @@ bail:
     return FALSE;
 }
 
+/*
+ * Only used as the reference for GLAMOR_VERIFY; miPolyGlyphBlt is the
+ * better fallback as it keeps the drawing on the GPU through
+ * PushPixels.
+ */
+static void
+glamor_poly_glyph_blt_bail(DrawablePtr drawable, GCPtr gc,
+                           int start_x, int y, unsigned int nglyph,
+                           CharInfoPtr *ppci, void *pglyph_base)
+{
+    if (glamor_prepare_access(drawable, GLAMOR_ACCESS_RW) &&
+        glamor_prepare_access_gc(gc)) {
+        fbPolyGlyphBlt(drawable, gc, start_x, y, nglyph, ppci, pglyph_base);
+    }
+    glamor_finish_access_gc(gc);
+    glamor_finish_access(drawable);
+}
+
 void
 glamor_poly_glyph_blt(DrawablePtr drawable, GCPtr gc,
                       int start_x, int y, unsigned int nglyph,
                       CharInfoPtr *ppci, void *pglyph_base)
 {
-    if (glamor_poly_glyph_blt_gl(drawable, gc, start_x, y, nglyph, ppci,
-                                 pglyph_base))
+    glamor_verify verify;
+    Bool ok;
+
+    glamor_verify_begin(drawable, NULL, 0, &verify);
+    ok = glamor_poly_glyph_blt_gl(drawable, gc, start_x, y, nglyph, ppci,
+                                  pglyph_base);
+    if (ok && glamor_verify_check(&verify))
+        glamor_poly_glyph_blt_bail(drawable, gc, start_x, y, nglyph,
+                                   ppci, pglyph_base);
+    glamor_verify_end(&verify, "glyph_blt");
+    if (ok)
         return;
     miPolyGlyphBlt(drawable, gc, start_x, y, nglyph,
                    ppci, pglyph_base);
@@ -234,10 +261,148 @@ bail:
     return FALSE;
 }
 
+struct push_bitmap_args {
+    PixmapPtr bitmap;
+    int x, y;
+};
+
+static Bool
+use_push_bitmap(PixmapPtr pixmap, GCPtr gc, glamor_program *prog, void *arg)
+{
+    struct push_bitmap_args *args = arg;
+    glamor_pixmap_private *bitmap_priv =
+        glamor_get_pixmap_private(args->bitmap);
+
+    glamor_bind_texture(glamor_get_screen_private(pixmap->drawable.pScreen),
+                        GL_TEXTURE0, bitmap_priv->fbo, FALSE);
+
+    glUniform2f(prog->fill_offset_uniform, -args->x, -args->y);
+    glUniform2f(prog->fill_size_inv_uniform,
+                1.0f / args->bitmap->drawable.width,
+                1.0f / args->bitmap->drawable.height);
+    return TRUE;
+}
+
+static const glamor_facet glamor_facet_push_bitmap = {
+    .name = "push_bitmap",
+    .vs_vars = "attribute vec2 primitive;\n",
+    .vs_exec = (GLAMOR_POS(gl_Position, primitive.xy)
+                "       fill_pos = (fill_offset + primitive.xy) * fill_size_inv;\n"),
+    .fs_exec = ("       if (texture2D(sampler, fill_pos).w == 0.0)\n"
+                "               discard;\n"),
+    .locations = glamor_program_location_fillsamp | glamor_program_location_fillpos,
+    .use = use_push_bitmap,
+};
+
+/*
+ * PushPixels from a GPU bitmap: draw the area as one quad, sampling
+ * the bitmap as the mask. The bitmap takes the fill's texture unit,
+ * so only solid fills are handled.
+ */
+static Bool
+glamor_push_bitmap_gl(GCPtr gc, PixmapPtr bitmap,
+                      DrawablePtr drawable, int w, int h, int x, int y)
+{
+    ScreenPtr screen = drawable->pScreen;
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    PixmapPtr pixmap = glamor_get_drawable_pixmap(drawable);
+    glamor_pixmap_private *pixmap_priv = glamor_get_pixmap_private(pixmap);
+    glamor_pixmap_private *bitmap_priv = glamor_get_pixmap_private(bitmap);
+    glamor_program *prog = &glamor_priv->push_bitmap_prog;
+    struct push_bitmap_args args;
+    RegionPtr clip = gc->pCompositeClip;
+    int box_index;
+    int off_x, off_y;
+    GLshort *v;
+    char *vbo_offset;
+
+    if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(pixmap_priv))
+        return FALSE;
+
+    if (glamor_pixmap_priv_is_large(bitmap_priv))
+        return FALSE;
+
+    if (gc->fillStyle != FillSolid)
+        return FALSE;
+
+    glamor_make_current(glamor_priv);
+
+    if (prog->failed)
+        return FALSE;
+
+    if (!prog->prog) {
+        if (!glamor_build_program(screen, prog, &glamor_facet_push_bitmap,
+                                  &glamor_fill_solid, NULL, NULL))
+            return FALSE;
+    }
+
+    args.bitmap = bitmap;
+    args.x = x;
+    args.y = y;
+    if (!glamor_use_program(pixmap, gc, prog, &args))
+        return FALSE;
+
+    v = glamor_get_vbo_space(screen, 8 * sizeof (GLshort), &vbo_offset);
+
+    glEnableVertexAttribArray(GLAMOR_VERTEX_POS);
+    glVertexAttribPointer(GLAMOR_VERTEX_POS, 2, GL_SHORT, GL_FALSE,
+                          2 * sizeof (GLshort), vbo_offset);
+
+    v[0] = x;           v[1] = y;
+    v[2] = x;           v[3] = y + h;
+    v[4] = x + w;       v[5] = y + h;
+    v[6] = x + w;       v[7] = y;
+
+    glamor_put_vbo_space(screen);
+
+    glEnable(GL_SCISSOR_TEST);
+
+    /* As with the points path below, x and y are already in screen
+     * coordinates */
+    glamor_pixmap_loop(pixmap_priv, box_index) {
+        int nbox = RegionNumRects(clip);
+        BoxPtr box = RegionRects(clip);
+
+        glamor_set_destination_drawable(drawable, box_index, FALSE, FALSE,
+                                        prog->matrix_uniform, &off_x, &off_y);
+
+        while (nbox--) {
+            glScissor(box->x1 + off_x,
+                      box->y1 + off_y,
+                      box->x2 - box->x1,
+                      box->y2 - box->y1);
+            box++;
+            glamor_glDrawArrays_GL_QUADS(glamor_priv, 1);
+        }
+    }
+
+    glDisable(GL_SCISSOR_TEST);
+    glDisableVertexAttribArray(GLAMOR_VERTEX_POS);
+
+    return TRUE;
+}
+
 void
 glamor_push_pixels(GCPtr pGC, PixmapPtr pBitmap,
                    DrawablePtr pDrawable, int w, int h, int x, int y)
 {
+    /* Both paths read the bitmap, from the FBO or from memory */
+    if (!glamor_pixmap_thaw(pBitmap))
+        return;
+
+    if (GLAMOR_PIXMAP_PRIV_HAS_FBO(glamor_get_pixmap_private(pBitmap))) {
+        if (glamor_push_bitmap_gl(pGC, pBitmap, pDrawable, w, h, x, y))
+            return;
+
+        /* Both paths below read the bitmap bits directly */
+        if (glamor_prepare_access(&pBitmap->drawable, GLAMOR_ACCESS_RO)) {
+            if (!glamor_push_pixels_gl(pGC, pBitmap, pDrawable, w, h, x, y))
+                miPushPixels(pGC, pBitmap, pDrawable, w, h, x, y);
+        }
+        glamor_finish_access(&pBitmap->drawable);
+        return;
+    }
+
     if (glamor_push_pixels_gl(pGC, pBitmap, pDrawable, w, h, x, y))
         return;
 
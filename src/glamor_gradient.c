@@ -38,6 +38,9 @@
 #define RADIAL_SMALL_STOPS (6 + 2)
 #define RADIAL_LARGE_STOPS (16 + 2)
 
+/* Larger stop counts are rounded up to a multiple of this */
+#define GRADIENT_STOPS_BUCKET 16
+
 #ifdef GLAMOR_GRADIENT_SHADER
 
 static const char *
@@ -180,12 +183,10 @@ _glamor_create_getcolor_fs_source(ScreenPtr screen, int stops_count,
     }
 }
 
-static void
-_glamor_create_radial_gradient_program(ScreenPtr screen, int stops_count,
-                                       int dyn_gen)
+static GLint
+_glamor_create_radial_gradient_program(ScreenPtr screen, int stops_count)
 {
     glamor_screen_private *glamor_priv;
-    int index;
 
     GLint gradient_prog = 0;
     char *gradient_fs = NULL;
@@ -317,18 +318,8 @@ _glamor_create_radial_gradient_program(ScreenPtr screen, int stops_count,
 
     glamor_priv = glamor_get_screen_private(screen);
 
-    if ((glamor_priv->radial_max_nstops >= stops_count) && (dyn_gen)) {
-        /* Very Good, not to generate again. */
-        return;
-    }
-
     glamor_make_current(glamor_priv);
 
-    if (dyn_gen && glamor_priv->gradient_prog[SHADER_GRADIENT_RADIAL][2]) {
-        glDeleteProgram(glamor_priv->gradient_prog[SHADER_GRADIENT_RADIAL][2]);
-        glamor_priv->gradient_prog[SHADER_GRADIENT_RADIAL][2] = 0;
-    }
-
     gradient_prog = glCreateProgram();
 
     vs_prog = glamor_compile_glsl_prog(GL_VERTEX_SHADER, gradient_vs);
@@ -357,27 +348,15 @@ _glamor_create_radial_gradient_program(ScreenPtr screen, int stops_count,
 
     glamor_link_glsl_prog(screen, gradient_prog, "radial gradient");
 
-    if (dyn_gen) {
-        index = 2;
-        glamor_priv->radial_max_nstops = stops_count;
-    }
-    else if (stops_count) {
-        index = 1;
-    }
-    else {
-        index = 0;
-    }
-
-    glamor_priv->gradient_prog[SHADER_GRADIENT_RADIAL][index] = gradient_prog;
+    glamor_priv->gradient_compiles++;
+    return gradient_prog;
 }
 
-static void
-_glamor_create_linear_gradient_program(ScreenPtr screen, int stops_count,
-                                       int dyn_gen)
+static GLint
+_glamor_create_linear_gradient_program(ScreenPtr screen, int stops_count)
 {
     glamor_screen_private *glamor_priv;
 
-    int index = 0;
     GLint gradient_prog = 0;
     char *gradient_fs = NULL;
     GLint fs_prog, vs_prog;
@@ -510,16 +489,7 @@ _glamor_create_linear_gradient_program(ScreenPtr screen, int stops_count,
 
     glamor_priv = glamor_get_screen_private(screen);
 
-    if ((glamor_priv->linear_max_nstops >= stops_count) && (dyn_gen)) {
-        /* Very Good, not to generate again. */
-        return;
-    }
-
     glamor_make_current(glamor_priv);
-    if (dyn_gen && glamor_priv->gradient_prog[SHADER_GRADIENT_LINEAR][2]) {
-        glDeleteProgram(glamor_priv->gradient_prog[SHADER_GRADIENT_LINEAR][2]);
-        glamor_priv->gradient_prog[SHADER_GRADIENT_LINEAR][2] = 0;
-    }
 
     gradient_prog = glCreateProgram();
 
@@ -546,40 +516,85 @@ _glamor_create_linear_gradient_program(ScreenPtr screen, int stops_count,
 
     glamor_link_glsl_prog(screen, gradient_prog, "linear gradient");
 
-    if (dyn_gen) {
-        index = 2;
-        glamor_priv->linear_max_nstops = stops_count;
-    }
-    else if (stops_count) {
-        index = 1;
-    }
-    else {
-        index = 0;
-    }
-
-    glamor_priv->gradient_prog[SHADER_GRADIENT_LINEAR][index] = gradient_prog;
+    glamor_priv->gradient_compiles++;
+    return gradient_prog;
 }
 
 void
 glamor_init_gradient_shader(ScreenPtr screen)
 {
     glamor_screen_private *glamor_priv;
-    int i;
 
     glamor_priv = glamor_get_screen_private(screen);
 
-    for (i = 0; i < 3; i++) {
-        glamor_priv->gradient_prog[SHADER_GRADIENT_LINEAR][i] = 0;
-        glamor_priv->gradient_prog[SHADER_GRADIENT_RADIAL][i] = 0;
+    glamor_priv->gradient_prog[SHADER_GRADIENT_LINEAR][0] =
+        _glamor_create_linear_gradient_program(screen, 0);
+    glamor_priv->gradient_prog[SHADER_GRADIENT_LINEAR][1] =
+        _glamor_create_linear_gradient_program(screen, LINEAR_LARGE_STOPS);
+
+    glamor_priv->gradient_prog[SHADER_GRADIENT_RADIAL][0] =
+        _glamor_create_radial_gradient_program(screen, 0);
+    glamor_priv->gradient_prog[SHADER_GRADIENT_RADIAL][1] =
+        _glamor_create_radial_gradient_program(screen, RADIAL_LARGE_STOPS);
+}
+
+void
+glamor_fini_gradient_shader(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+
+    LogMessageVerb(X_INFO, 3,
+                   "glamor%d: gradient programs: %lu compiled, "
+                   "%lu cache hits, %lu evicted\n", screen->myNum,
+                   glamor_priv->gradient_compiles,
+                   glamor_priv->gradient_cache_hits,
+                   glamor_priv->gradient_cache_evictions);
+}
+
+/*
+ * Programs for more stops than the large static ones hold are kept in
+ * a small cache keyed by gradient type and stop count, rounded up to
+ * GRADIENT_STOPS_BUCKET so that nearby counts share a program. The
+ * repeat mode is a uniform and doesn't need to be part of the key.
+ * When the cache is full the least recently used program goes.
+ */
+static GLint
+glamor_gradient_cached_program(ScreenPtr screen, enum gradient_shader type,
+                               int stops_count)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    struct glamor_gradient_cache_entry *entry, *victim = NULL;
+    int nstops = ALIGN(stops_count, GRADIENT_STOPS_BUCKET);
+    int i;
+
+    for (i = 0; i < GLAMOR_GRADIENT_CACHE_SIZE; i++) {
+        entry = &glamor_priv->gradient_cache[i];
+
+        if (entry->prog && entry->type == type && entry->nstops == nstops) {
+            entry->last_use = ++glamor_priv->gradient_cache_clock;
+            glamor_priv->gradient_cache_hits++;
+            return entry->prog;
+        }
+
+        if (!victim || !entry->prog ||
+            (victim->prog && entry->last_use < victim->last_use))
+            victim = entry;
     }
-    glamor_priv->linear_max_nstops = 0;
-    glamor_priv->radial_max_nstops = 0;
 
-    _glamor_create_linear_gradient_program(screen, 0, 0);
-    _glamor_create_linear_gradient_program(screen, LINEAR_LARGE_STOPS, 0);
+    if (victim->prog) {
+        glamor_make_current(glamor_priv);
+        glDeleteProgram(victim->prog);
+        glamor_priv->gradient_cache_evictions++;
+    }
 
-    _glamor_create_radial_gradient_program(screen, 0, 0);
-    _glamor_create_radial_gradient_program(screen, RADIAL_LARGE_STOPS, 0);
+    if (type == SHADER_GRADIENT_LINEAR)
+        victim->prog = _glamor_create_linear_gradient_program(screen, nstops);
+    else
+        victim->prog = _glamor_create_radial_gradient_program(screen, nstops);
+    victim->type = type;
+    victim->nstops = nstops;
+    victim->last_use = ++glamor_priv->gradient_cache_clock;
+    return victim->prog;
 }
 
 static void
@@ -893,10 +908,9 @@ glamor_generate_radial_gradient_picture(ScreenPtr screen,
         gradient_prog = glamor_priv->gradient_prog[SHADER_GRADIENT_RADIAL][1];
     }
     else {
-        _glamor_create_radial_gradient_program(screen,
-                                               src_picture->pSourcePict->linear.
-                                               nstops + 2, 1);
-        gradient_prog = glamor_priv->gradient_prog[SHADER_GRADIENT_RADIAL][2];
+        gradient_prog = glamor_gradient_cached_program(screen,
+                                                       SHADER_GRADIENT_RADIAL,
+                                                       stops_count);
     }
 
     /* Bind all the uniform vars . */
@@ -1202,10 +1216,9 @@ glamor_generate_linear_gradient_picture(ScreenPtr screen,
         gradient_prog = glamor_priv->gradient_prog[SHADER_GRADIENT_LINEAR][1];
     }
     else {
-        _glamor_create_linear_gradient_program(screen,
-                                               src_picture->pSourcePict->linear.
-                                               nstops + 2, 1);
-        gradient_prog = glamor_priv->gradient_prog[SHADER_GRADIENT_LINEAR][2];
+        gradient_prog = glamor_gradient_cached_program(screen,
+                                                       SHADER_GRADIENT_LINEAR,
+                                                       stops_count);
     }
 
     /* Bind all the uniform vars . */
@@ -0,0 +1,240 @@
+/*
+ * Copyright © 2014 Keith Packard
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include "glamor_priv.h"
+
+/*
+ * Background work run while the server is idle.
+ *
+ * The server counts as idle once it has slept for GLAMOR_IDLE_DELAY
+ * milliseconds without anything waking it up. The block handler then
+ * runs the registered tasks one step at a time, round robin, until
+ * each has run out of work or its own budget, or GLAMOR_IDLE_BUDGET
+ * microseconds have gone by in total. A step is never interrupted, so
+ * tasks keep their steps short; those that overrun are counted.
+ *
+ * After any activity, or when tasks still have work left, the sleep
+ * is cut to GLAMOR_IDLE_DELAY so that the next idle period is noticed
+ * without waiting for a client. A budget of 0 disables the scheduler.
+ */
+
+#define GLAMOR_IDLE_BUDGET_DEFAULT      4000
+#define GLAMOR_IDLE_DELAY_DEFAULT       100
+
+/* A server too busy to ever sleep that long still gets its
+ * background work done this often, between requests */
+#define GLAMOR_IDLE_STARVE_MS           5000
+
+static Bool
+glamor_idle_cold(ScreenPtr screen)
+{
+    return glamor_cold_reclaim(screen, FALSE) > 0;
+}
+
+void
+glamor_idle_init(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    char *budget_string, *delay_string;
+    int budget = GLAMOR_IDLE_BUDGET_DEFAULT;
+    int delay = GLAMOR_IDLE_DELAY_DEFAULT;
+
+    budget_string = getenv("GLAMOR_IDLE_BUDGET");
+    if (budget_string && sscanf(budget_string, "%d", &budget) != 1)
+        budget = GLAMOR_IDLE_BUDGET_DEFAULT;
+
+    delay_string = getenv("GLAMOR_IDLE_DELAY");
+    if (delay_string && sscanf(delay_string, "%d", &delay) != 1)
+        delay = GLAMOR_IDLE_DELAY_DEFAULT;
+
+    glamor_priv->idle_budget = MAX(budget, 0);
+    glamor_priv->idle_delay = MAX(delay, 0);
+    glamor_priv->idle_block_time = GetTimeInMillis();
+    glamor_priv->idle_last_run = glamor_priv->idle_block_time;
+
+    if (!glamor_priv->idle_budget)
+        return;
+
+    glamor_idle_add_task(screen, "readback trim", glamor_readback_trim, 500);
+    glamor_idle_add_task(screen, "prefetch trim", glamor_prefetch_trim, 500);
+    glamor_idle_add_task(screen, "mipmaps", glamor_composite_refresh_mipmaps,
+                         1000);
+    glamor_idle_add_task(screen, "shader warm-up",
+                         glamor_composite_warm_shaders, 2000);
+    glamor_idle_add_task(screen, "cold pixmaps", glamor_idle_cold, 2000);
+}
+
+void
+glamor_idle_fini(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_idle_task *task;
+    int i;
+
+    if (!glamor_priv->idle_periods)
+        return;
+
+    LogMessageVerb(X_INFO, 3, "glamor%d: idle work: %lu idle periods\n",
+                   screen->myNum, glamor_priv->idle_periods);
+
+    for (i = 0; i < glamor_priv->idle_ntasks; i++) {
+        task = &glamor_priv->idle_tasks[i];
+        if (!task->steps)
+            continue;
+        LogMessageVerb(X_INFO, 3,
+                       "glamor%d: idle %s: %lu steps, %llu us, %llu us max, "
+                       "%lu over budget\n", screen->myNum, task->name,
+                       task->steps, (unsigned long long) task->total_us,
+                       (unsigned long long) task->max_us, task->over_budget);
+    }
+}
+
+/*
+ * Register a task to run while the server is idle. 'run' does one
+ * short step of work and returns FALSE when it had nothing to do;
+ * 'budget' bounds the microseconds spent on it per idle period.
+ */
+Bool
+glamor_idle_add_task(ScreenPtr screen, const char *name,
+                     Bool (*run)(ScreenPtr screen), int budget)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_idle_task *task;
+
+    if (!glamor_priv->idle_budget ||
+        glamor_priv->idle_ntasks == GLAMOR_IDLE_MAX_TASKS)
+        return FALSE;
+
+    task = &glamor_priv->idle_tasks[glamor_priv->idle_ntasks++];
+    memset(task, 0, sizeof(*task));
+    task->name = name;
+    task->run = run;
+    task->budget = budget;
+    return TRUE;
+}
+
+/*
+ * Run tasks until they are done or the budgets are used up. Returns
+ * whether any of them still has work left.
+ */
+static Bool
+glamor_idle_run(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    uint64_t spent[GLAMOR_IDLE_MAX_TASKS] = { 0 };
+    Bool active[GLAMOR_IDLE_MAX_TASKS];
+    glamor_idle_task *task;
+    CARD64 start, now, end;
+    int i, nactive = glamor_priv->idle_ntasks;
+    Bool did_work = FALSE;
+    uint64_t us;
+
+    for (i = 0; i < nactive; i++)
+        active[i] = TRUE;
+
+    glamor_make_current(glamor_priv);
+    start = now = GetTimeInMicros();
+
+    while (nactive && now - start < glamor_priv->idle_budget) {
+        for (i = 0; i < glamor_priv->idle_ntasks; i++) {
+            if (!active[i] || now - start >= glamor_priv->idle_budget)
+                continue;
+
+            task = &glamor_priv->idle_tasks[i];
+            if (!task->run(screen)) {
+                active[i] = FALSE;
+                nactive--;
+                now = GetTimeInMicros();
+                continue;
+            }
+
+            end = GetTimeInMicros();
+            us = end - now;
+            now = end;
+
+            did_work = TRUE;
+            task->steps++;
+            task->total_us += us;
+            if (us > task->max_us)
+                task->max_us = us;
+            if (us > task->budget)
+                task->over_budget++;
+
+            spent[i] += us;
+            if (spent[i] >= task->budget) {
+                /* Left for the next idle period */
+                active[i] = FALSE;
+                nactive--;
+            }
+        }
+    }
+
+    if (did_work) {
+        glFlush();
+        glamor_priv->idle_periods++;
+        return TRUE;
+    }
+    return nactive > 0;
+}
+
+/*
+ * Called from the block handler once the rest of the screen's block
+ * handlers have had their say about 'timeout'.
+ */
+void
+glamor_idle_block(ScreenPtr screen, void *timeout)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    CARD32 now = GetTimeInMillis();
+    Bool busy = timeout && *(int *) timeout == 0;
+    Bool more = TRUE;
+
+    if (!glamor_priv->idle_ntasks)
+        return;
+
+    if (!busy &&
+        (glamor_priv->idle_slept >= glamor_priv->idle_delay ||
+         now - glamor_priv->idle_last_run >= GLAMOR_IDLE_STARVE_MS)) {
+        more = glamor_idle_run(screen);
+        glamor_priv->idle_last_run = now;
+    }
+
+    if (more && timeout)
+        AdjustWaitForDelay(timeout, glamor_priv->idle_delay);
+
+    glamor_priv->idle_slept = 0;
+    glamor_priv->idle_block_time = GetTimeInMillis();
+}
+
+/*
+ * Called from the wakeup handler; only a sleep that ran out without
+ * any client or device activity counts towards being idle.
+ */
+void
+glamor_idle_wakeup(ScreenPtr screen, int result)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+
+    if (result == 0)
+        glamor_priv->idle_slept =
+            GetTimeInMillis() - glamor_priv->idle_block_time;
+}
@@ -58,6 +58,9 @@ glamor_put_image_gl(DrawablePtr drawable, GCPtr gc, int depth, int x, int y,
     if (format != ZPixmap)
         goto bail;
 
+    if (!glamor_pixmap_unshare(pixmap))
+        goto bail;
+
     x += drawable->x;
     y += drawable->y;
     box.x1 = x;
@@ -97,9 +100,19 @@ void
 glamor_put_image(DrawablePtr drawable, GCPtr gc, int depth, int x, int y,
                  int w, int h, int leftPad, int format, char *bits)
 {
-    if (glamor_put_image_gl(drawable, gc, depth, x, y, w, h, leftPad, format, bits))
+    glamor_dispatch dispatch;
+
+    glamor_trace_begin(GLAMOR_TRACE_PUT_IMAGE, w, h);
+    if (glamor_dispatch_begin(&dispatch, GLAMOR_DISPATCH_PUT_IMAGE,
+                              drawable, NULL, (uint64_t) w * h) &&
+        glamor_put_image_gl(drawable, gc, depth, x, y, w, h, leftPad, format, bits)) {
+        glamor_dispatch_end(&dispatch, TRUE);
+        glamor_trace_end(GLAMOR_TRACE_PUT_IMAGE);
         return;
+    }
     glamor_put_image_bail(drawable, gc, depth, x, y, w, h, leftPad, format, bits);
+    glamor_dispatch_end(&dispatch, FALSE);
+    glamor_trace_end(GLAMOR_TRACE_PUT_IMAGE);
 }
 
 static Bool
@@ -120,6 +133,15 @@ glamor_get_image_gl(DrawablePtr drawable, int x, int y, int w, int h,
         goto bail;
 
     glamor_get_drawable_deltas(drawable, pixmap, &off_x, &off_y);
+
+    /* Screen scrapers read the same areas over and over */
+    box.x1 = x + drawable->x + off_x;
+    box.x2 = box.x1 + w;
+    box.y1 = y + drawable->y + off_y;
+    box.y2 = box.y1 + h;
+    if (glamor_readback_get(pixmap, &box, (uint8_t *) d, byte_stride))
+        return TRUE;
+
     box.x1 = x;
     box.x2 = x + w;
     box.y1 = y;
@@ -146,7 +168,17 @@ void
 glamor_get_image(DrawablePtr drawable, int x, int y, int w, int h,
                  unsigned int format, unsigned long plane_mask, char *d)
 {
-    if (glamor_get_image_gl(drawable, x, y, w, h, format, plane_mask, d))
+    glamor_dispatch dispatch;
+
+    glamor_trace_begin(GLAMOR_TRACE_GET_IMAGE, w, h);
+    if (glamor_dispatch_begin(&dispatch, GLAMOR_DISPATCH_GET_IMAGE,
+                              drawable, NULL, (uint64_t) w * h) &&
+        glamor_get_image_gl(drawable, x, y, w, h, format, plane_mask, d)) {
+        glamor_dispatch_end(&dispatch, TRUE);
+        glamor_trace_end(GLAMOR_TRACE_GET_IMAGE);
         return;
+    }
     glamor_get_image_bail(drawable, x, y, w, h, format, plane_mask, d);
+    glamor_dispatch_end(&dispatch, FALSE);
+    glamor_trace_end(GLAMOR_TRACE_GET_IMAGE);
 }
@@ -233,6 +233,49 @@ glamor_get_tex_format_type_from_pictformat(ScreenPtr pScreen,
     return TRUE;
 }
 
+struct glamor_convert_job {
+    PictFormatShort dst_format;
+    PictFormatShort src_format;
+    uint8_t *dst_bits;
+    uint8_t *src_bits;
+    int dst_stride;
+    int src_stride;
+    int w;
+    Bool failed;
+};
+
+/*
+ * Convert rows [y1, y2) using images over just those rows, so that
+ * stripes running on different threads share no pixman state.
+ */
+static void
+glamor_convert_stripe(void *closure, int y1, int y2)
+{
+    struct glamor_convert_job *job = closure;
+    pixman_image_t *dst_image;
+    pixman_image_t *src_image;
+
+    dst_image = pixman_image_create_bits(job->dst_format, job->w, y2 - y1,
+                                         (uint32_t *) (job->dst_bits +
+                                                       y1 * job->dst_stride),
+                                         job->dst_stride);
+    src_image = pixman_image_create_bits(job->src_format, job->w, y2 - y1,
+                                         (uint32_t *) (job->src_bits +
+                                                       y1 * job->src_stride),
+                                         job->src_stride);
+
+    if (dst_image && src_image)
+        pixman_image_composite(PictOpSrc, src_image, NULL, dst_image,
+                               0, 0, 0, 0, 0, 0, job->w, y2 - y1);
+    else
+        __atomic_store_n(&job->failed, TRUE, __ATOMIC_RELAXED);
+
+    if (src_image)
+        pixman_image_unref(src_image);
+    if (dst_image)
+        pixman_image_unref(dst_image);
+}
+
 /**
  * Takes a set of source bits with a given format and returns an
  * in-memory pixman image of those bits in a destination format.
@@ -245,24 +288,29 @@ glamor_get_converted_image(PictFormatShort dst_format,
                            int w, int h)
 {
     pixman_image_t *dst_image;
-    pixman_image_t *src_image;
+    struct glamor_convert_job job;
 
     dst_image = pixman_image_create_bits(dst_format, w, h, NULL, 0);
     if (dst_image == NULL) {
         return NULL;
     }
 
-    src_image = pixman_image_create_bits(src_format, w, h, src_bits, src_stride);
+    job.dst_format = dst_format;
+    job.src_format = src_format;
+    job.dst_bits = (uint8_t *) pixman_image_get_data(dst_image);
+    job.src_bits = src_bits;
+    job.dst_stride = pixman_image_get_stride(dst_image);
+    job.src_stride = src_stride;
+    job.w = w;
+    job.failed = FALSE;
 
-    if (src_image == NULL) {
+    glamor_run_stripes(glamor_convert_stripe, &job, h,
+                       (size_t) h * (job.dst_stride + src_stride));
+
+    if (job.failed) {
         pixman_image_unref(dst_image);
         return NULL;
     }
-
-    pixman_image_composite(PictOpSrc, src_image, NULL, dst_image,
-                           0, 0, 0, 0, 0, 0, w, h);
-
-    pixman_image_unref(src_image);
     return dst_image;
 }
 
@@ -340,6 +388,10 @@ glamor_upload_picture_to_texture(PicturePtr picture)
     else
         iformat = format;
 
+    /* 565 storage would drop the alpha of 4444 pictures */
+    if (iformat == GL_RGB && PICT_FORMAT_A(picture->format))
+        iformat = GL_RGBA;
+
     if (!glamor_pixmap_ensure_fbo(pixmap, iformat, GLAMOR_CREATE_FBO_NO_FBO))
         goto fail;
 
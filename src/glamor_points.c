@@ -87,11 +87,13 @@ glamor_poly_point_gl(DrawablePtr drawable, GCPtr gc, int mode, int npt, DDXPoint
     glEnable(GL_SCISSOR_TEST);
 
     glamor_pixmap_loop(pixmap_priv, box_index) {
-        int nbox = RegionNumRects(gc->pCompositeClip);
-        BoxPtr box = RegionRects(gc->pCompositeClip);
+        int nbox;
+        BoxPtr box;
 
         glamor_set_destination_drawable(drawable, box_index, TRUE, TRUE,
                                         prog->matrix_uniform, &off_x, &off_y);
+        nbox = glamor_stencil_clip(drawable, gc->pCompositeClip,
+                                   off_x, off_y, npt, &box);
 
         while (nbox--) {
             glScissor(box->x1 + off_x,
@@ -104,6 +106,7 @@ glamor_poly_point_gl(DrawablePtr drawable, GCPtr gc, int mode, int npt, DDXPoint
     }
 
     glDisable(GL_SCISSOR_TEST);
+    glamor_stencil_clip_done(drawable->pScreen);
     glDisableVertexAttribArray(GLAMOR_VERTEX_POS);
 
     return TRUE;
@@ -0,0 +1,370 @@
+/*
+ * Copyright © 2014 Keith Packard
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+
+#include "glamor_priv.h"
+#include "glamor_transfer.h"
+
+/*
+ * Reading back ahead of fb fallbacks.
+ *
+ * Some GC state can't be drawn with on the GPU at all: planemasks that
+ * aren't solid, and logic ops other than GXcopy on GLES2. Once
+ * ValidateGC sees such a GC, whatever is drawn next maps the
+ * destination for fb and waits for it to be read back. Instead, the
+ * drawable is read into a PBO straight away and the readback flushed,
+ * so the GPU works on it while the request is parsed, and
+ * glamor_prep_pixmap_box() only has to map the PBO.
+ *
+ * Pixmaps that have been predicted to fall back, or that have fallen
+ * back in Composite, also keep their PBO from glamor_fini_pixmap(),
+ * along with the area of it matching the pixmap, so a run of
+ * fallbacks on one drawable reads it back once. The pixmap serial
+ * tells whether the PBO is still current.
+ *
+ * Kept PBOs are freed least recently used first once their total size
+ * passes GLAMOR_PREFETCH_CACHE megabytes, 0 disabling all this.
+ */
+
+#define GLAMOR_PREFETCH_CACHE_DEFAULT   64
+
+void
+glamor_prefetch_init(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    char *cache_string;
+    int megabytes = GLAMOR_PREFETCH_CACHE_DEFAULT;
+
+    cache_string = getenv("GLAMOR_PREFETCH_CACHE");
+    if (cache_string && sscanf(cache_string, "%d", &megabytes) != 1)
+        megabytes = GLAMOR_PREFETCH_CACHE_DEFAULT;
+
+    xorg_list_init(&glamor_priv->prefetch_list);
+    glamor_priv->prefetch_max = (size_t) MAX(megabytes, 0) << 20;
+}
+
+static void
+glamor_prefetch_destroy(glamor_screen_private *glamor_priv,
+                        glamor_pixmap_private *priv)
+{
+    xorg_list_del(&priv->prefetch_link);
+    glamor_priv->prefetch_size -= priv->prefetch_size;
+    glDeleteBuffers(1, &priv->prefetch_pbo);
+    priv->prefetch_pbo = 0;
+    priv->prefetch_size = 0;
+}
+
+/*
+ * Free every PBO, on close or under memory pressure
+ */
+void
+glamor_prefetch_flush(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_pixmap_private *priv, *tmp;
+
+    xorg_list_for_each_entry_safe(priv, tmp, &glamor_priv->prefetch_list,
+                                  prefetch_link)
+        glamor_prefetch_destroy(glamor_priv, priv);
+}
+
+void
+glamor_prefetch_fini(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+
+    glamor_make_current(glamor_priv);
+    glamor_prefetch_flush(screen);
+
+    if (glamor_priv->prefetch_reads || glamor_priv->prefetch_hits)
+        LogMessageVerb(X_INFO, 3,
+                       "glamor%d: fallback prefetch: %lu readbacks ahead, "
+                       "%lu used, %lu out of date\n",
+                       screen->myNum, glamor_priv->prefetch_reads,
+                       glamor_priv->prefetch_hits,
+                       glamor_priv->prefetch_misses);
+}
+
+/*
+ * Free the PBO of a pixmap being destroyed
+ */
+void
+glamor_prefetch_free(PixmapPtr pixmap, glamor_pixmap_private *priv)
+{
+    glamor_screen_private *glamor_priv =
+        glamor_get_screen_private(pixmap->drawable.pScreen);
+
+    if (!priv->prefetch_pbo)
+        return;
+
+    glamor_make_current(glamor_priv);
+    glamor_prefetch_destroy(glamor_priv, priv);
+}
+
+/*
+ * As with the GetImage cache, only pixmaps glamor alone draws to;
+ * clients render to exported ones, the screen pixmap among them,
+ * behind our back. A stale read back would be written over what they
+ * drew when the fallback finishes.
+ */
+static Bool
+glamor_prefetch_allowed(glamor_screen_private *glamor_priv,
+                        PixmapPtr pixmap, glamor_pixmap_private *priv)
+{
+    if (!glamor_priv->prefetch_max || !glamor_priv->has_rw_pbo ||
+        pixmap->drawable.bitsPerPixel == 1 ||
+        !GLAMOR_PIXMAP_PRIV_HAS_FBO(priv))
+        return FALSE;
+
+    if ((size_t) pixmap->devKind * pixmap->drawable.height >
+        glamor_priv->prefetch_max)
+        return FALSE;
+
+    return priv->type == GLAMOR_TEXTURE_ONLY;
+}
+
+/*
+ * Clip 'box' to the pixmap, returning FALSE if nothing is left
+ */
+static Bool
+glamor_prefetch_clip(PixmapPtr pixmap, const BoxRec *box, BoxPtr clipped)
+{
+    clipped->x1 = MAX(box->x1, 0);
+    clipped->y1 = MAX(box->y1, 0);
+    clipped->x2 = MIN(box->x2, pixmap->drawable.width);
+    clipped->y2 = MIN(box->y2, pixmap->drawable.height);
+    return clipped->x1 < clipped->x2 && clipped->y1 < clipped->y2;
+}
+
+static Bool
+glamor_prefetch_current(PixmapPtr pixmap, glamor_pixmap_private *priv,
+                        const BoxRec *box)
+{
+    return priv->prefetch_serial == priv->serial &&
+        priv->prefetch_size ==
+        (size_t) pixmap->devKind * pixmap->drawable.height &&
+        box->x1 >= priv->prefetch_box.x1 && box->x2 <= priv->prefetch_box.x2 &&
+        box->y1 >= priv->prefetch_box.y1 && box->y2 <= priv->prefetch_box.y2;
+}
+
+/*
+ * Hand 'pbo', holding 'box' of the pixmap as of now, over to the cache
+ */
+static void
+glamor_prefetch_add(glamor_screen_private *glamor_priv, PixmapPtr pixmap,
+                    glamor_pixmap_private *priv, GLuint pbo, const BoxRec *box)
+{
+    size_t size = (size_t) pixmap->devKind * pixmap->drawable.height;
+
+    if (priv->prefetch_pbo)
+        glamor_prefetch_destroy(glamor_priv, priv);
+
+    /* Make room, oldest first */
+    while (glamor_priv->prefetch_size + size > glamor_priv->prefetch_max)
+        glamor_prefetch_destroy(glamor_priv,
+                                xorg_list_first_entry(&glamor_priv->prefetch_list,
+                                                      glamor_pixmap_private,
+                                                      prefetch_link));
+
+    priv->prefetch_pbo = pbo;
+    priv->prefetch_box = *box;
+    priv->prefetch_serial = priv->serial;
+    priv->prefetch_size = size;
+    xorg_list_append(&priv->prefetch_link, &glamor_priv->prefetch_list);
+    glamor_priv->prefetch_size += size;
+}
+
+/*
+ * Start reading 'box' of the pixmap, in pixmap coordinates, into a
+ * PBO for the fallback expected next
+ */
+static void
+glamor_prefetch_box(PixmapPtr pixmap, const BoxRec *box)
+{
+    glamor_screen_private *glamor_priv =
+        glamor_get_screen_private(pixmap->drawable.pScreen);
+    glamor_pixmap_private *priv;
+    BoxRec clipped;
+    GLuint pbo;
+
+    priv = glamor_get_pixmap_private(pixmap);
+    if (!glamor_prefetch_allowed(glamor_priv, pixmap, priv) ||
+        pixmap->devPrivate.ptr ||
+        !glamor_prefetch_clip(pixmap, box, &clipped))
+        return;
+
+    priv->prefetch_wanted = TRUE;
+
+    if (priv->prefetch_pbo &&
+        glamor_prefetch_current(pixmap, priv, &clipped))
+        return;
+
+    glamor_make_current(glamor_priv);
+
+    glGenBuffers(1, &pbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER,
+                 pixmap->devKind * pixmap->drawable.height, NULL,
+                 GL_STREAM_READ);
+    glamor_download_boxes(pixmap, &clipped, 1, 0, 0, 0, 0,
+                          NULL, pixmap->devKind);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    /* Get the GPU going on it; mapping the PBO waits for the rest */
+    glFlush();
+
+    glamor_prefetch_add(glamor_priv, pixmap, priv, pbo, &clipped);
+    glamor_priv->prefetch_reads++;
+}
+
+/*
+ * GC state none of the GL paths can draw with
+ */
+static Bool
+glamor_prefetch_gc_falls_back(GCPtr gc)
+{
+    glamor_screen_private *glamor_priv =
+        glamor_get_screen_private(gc->pScreen);
+
+    if (!glamor_pm_is_solid(gc->depth, gc->planemask))
+        return TRUE;
+
+    return glamor_priv->gl_flavor == GLAMOR_GL_ES2 && gc->alu != GXcopy;
+}
+
+/*
+ * Called at the end of ValidateGC, once the composite clip is known.
+ * Fallbacks mostly map the whole drawable, so that is what is read.
+ */
+void
+glamor_prefetch_gc(GCPtr gc, DrawablePtr drawable)
+{
+    PixmapPtr pixmap;
+    BoxRec box;
+    int off_x, off_y;
+
+    if (!glamor_prefetch_gc_falls_back(gc) || !gc->pCompositeClip ||
+        !RegionNotEmpty(gc->pCompositeClip))
+        return;
+
+    pixmap = glamor_get_drawable_pixmap(drawable);
+    glamor_get_drawable_deltas(drawable, pixmap, &off_x, &off_y);
+
+    box.x1 = drawable->x + off_x;
+    box.x2 = box.x1 + drawable->width;
+    box.y1 = drawable->y + off_y;
+    box.y2 = box.y1 + drawable->height;
+    glamor_prefetch_box(pixmap, &box);
+}
+
+/*
+ * Called when a picture is about to be used by an fb fallback nothing
+ * predicted, so that the PBO is kept for the next one
+ */
+void
+glamor_prefetch_picture(PicturePtr picture)
+{
+    PixmapPtr pixmap;
+    glamor_pixmap_private *priv;
+
+    if (!picture || !picture->pDrawable)
+        return;
+
+    pixmap = glamor_get_drawable_pixmap(picture->pDrawable);
+    priv = glamor_get_pixmap_private(pixmap);
+    priv->prefetch_wanted = TRUE;
+}
+
+/*
+ * Called by glamor_prep_pixmap_box() when first mapping 'box' of the
+ * pixmap. Returns a PBO already holding it, or 0 to read it back.
+ */
+GLuint
+glamor_prefetch_take(PixmapPtr pixmap, glamor_pixmap_private *priv,
+                     const BoxRec *box)
+{
+    glamor_screen_private *glamor_priv =
+        glamor_get_screen_private(pixmap->drawable.pScreen);
+    BoxRec clipped;
+    GLuint pbo = priv->prefetch_pbo;
+
+    if (!pbo)
+        return 0;
+
+    if (glamor_prefetch_clip(pixmap, box, &clipped) &&
+        glamor_prefetch_current(pixmap, priv, &clipped)) {
+        xorg_list_del(&priv->prefetch_link);
+        glamor_priv->prefetch_size -= priv->prefetch_size;
+        priv->prefetch_pbo = 0;
+        priv->prefetch_size = 0;
+        glamor_priv->prefetch_hits++;
+        return pbo;
+    }
+
+    glamor_prefetch_destroy(glamor_priv, priv);
+    glamor_priv->prefetch_misses++;
+    return 0;
+}
+
+/*
+ * Called by glamor_fini_pixmap() with the PBO it is done with, which
+ * holds 'box' of the pixmap as of now. Returns whether the PBO was
+ * kept, leaving the caller to delete it otherwise.
+ */
+Bool
+glamor_prefetch_keep(PixmapPtr pixmap, glamor_pixmap_private *priv,
+                     GLuint pbo, const BoxRec *box)
+{
+    glamor_screen_private *glamor_priv =
+        glamor_get_screen_private(pixmap->drawable.pScreen);
+    BoxRec clipped;
+
+    if (!priv->prefetch_wanted ||
+        !glamor_prefetch_allowed(glamor_priv, pixmap, priv) ||
+        !glamor_prefetch_clip(pixmap, box, &clipped))
+        return FALSE;
+
+    glamor_prefetch_add(glamor_priv, pixmap, priv, pbo, &clipped);
+    return TRUE;
+}
+
+/*
+ * Idle task: free the oldest PBO drawn over with GL since it was
+ * kept. The fallbacks on that pixmap look to be over, so it stops
+ * keeping them until another is seen coming.
+ */
+Bool
+glamor_prefetch_trim(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_pixmap_private *priv;
+
+    xorg_list_for_each_entry(priv, &glamor_priv->prefetch_list,
+                             prefetch_link) {
+        if (priv->prefetch_serial != priv->serial) {
+            priv->prefetch_wanted = FALSE;
+            glamor_prefetch_destroy(glamor_priv, priv);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
@@ -24,6 +24,253 @@
 #include "glamor_prepare.h"
 #include "glamor_transfer.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <smmintrin.h>
+#define GLAMOR_HAS_STREAM_LOAD 1
+#endif
+
+/*
+ * PBO mappings are often write-combined or uncached, which makes fb
+ * crawl whenever it reads the destination. When a one-time probe finds
+ * reading the mapping much slower than reading cached memory, the
+ * prepared rows are streamed into a cached staging copy for fb to
+ * work on. Rows fb changed are found by comparing with a second copy
+ * and uploaded straight from the staging memory when finished.
+ *
+ * GLAMOR_PREPARE_STAGING=0 or 1 skips the probe.
+ */
+
+/* Bytes read from a mapping to decide; smaller mappings wait */
+#define GLAMOR_STAGING_PROBE_BYTES      (256 * 1024)
+
+/* Reading the mapping must be this many times slower to stage */
+#define GLAMOR_STAGING_MIN_RATIO        4
+
+void
+glamor_prepare_init(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    char *staging_string;
+    int staging;
+
+    glamor_priv->prep_staging = -1;
+    staging_string = getenv("GLAMOR_PREPARE_STAGING");
+    if (staging_string && sscanf(staging_string, "%d", &staging) == 1)
+        glamor_priv->prep_staging = staging != 0;
+}
+
+#ifdef GLAMOR_HAS_STREAM_LOAD
+/*
+ * MOVNTDQA reads write-combined memory a cache line at a time
+ * instead of a word at a time
+ */
+__attribute__((target("sse4.1")))
+static void
+glamor_stream_copy_sse41(uint8_t *dst, const uint8_t *src, size_t size)
+{
+    while (size && ((uintptr_t) src & 15)) {
+        *dst++ = *src++;
+        size--;
+    }
+
+    while (size >= 64) {
+        __m128i a = _mm_stream_load_si128((__m128i *) src);
+        __m128i b = _mm_stream_load_si128((__m128i *) (src + 16));
+        __m128i c = _mm_stream_load_si128((__m128i *) (src + 32));
+        __m128i d = _mm_stream_load_si128((__m128i *) (src + 48));
+
+        _mm_storeu_si128((__m128i *) dst, a);
+        _mm_storeu_si128((__m128i *) (dst + 16), b);
+        _mm_storeu_si128((__m128i *) (dst + 32), c);
+        _mm_storeu_si128((__m128i *) (dst + 48), d);
+        src += 64;
+        dst += 64;
+        size -= 64;
+    }
+
+    while (size >= 16) {
+        _mm_storeu_si128((__m128i *) dst,
+                         _mm_stream_load_si128((__m128i *) src));
+        src += 16;
+        dst += 16;
+        size -= 16;
+    }
+
+    memcpy(dst, src, size);
+}
+#endif
+
+static void
+glamor_stream_copy(uint8_t *dst, const uint8_t *src, size_t size)
+{
+#ifdef GLAMOR_HAS_STREAM_LOAD
+    if (__builtin_cpu_supports("sse4.1")) {
+        glamor_stream_copy_sse41(dst, src, size);
+        return;
+    }
+#endif
+    memcpy(dst, src, size);
+}
+
+/*
+ * Compare reading the mapping against reading cached memory, the way
+ * fb would read them.
+ */
+static Bool
+glamor_prep_probe_staging(const uint8_t *map)
+{
+    size_t size = GLAMOR_STAGING_PROBE_BYTES;
+    uint8_t *cached = malloc(size * 2);
+    CARD64 start, map_us, cached_us;
+
+    if (!cached)
+        return FALSE;
+
+    /* Fault everything in before timing */
+    memset(cached, 0, size * 2);
+    memcpy(cached, map, size);
+
+    start = GetTimeInMicros();
+    memcpy(cached, map, size);
+    map_us = GetTimeInMicros() - start;
+
+    start = GetTimeInMicros();
+    memcpy(cached + size, cached, size);
+    cached_us = GetTimeInMicros() - start;
+
+    free(cached);
+
+    LogMessageVerb(X_INFO, 3,
+                   "glamor: reading %d bytes took %llu us mapped, "
+                   "%llu us cached\n", (int) size, (unsigned long long) map_us,
+                   (unsigned long long) cached_us);
+
+    return map_us > MAX(cached_us, 1) * GLAMOR_STAGING_MIN_RATIO;
+}
+
+/*
+ * Copy rows [y1, y2) of the fresh mapping in pixmap->devPrivate.ptr
+ * into the staging copy and point fb there. 'first' is set for the
+ * initial mapping, the only time staging may start.
+ */
+static void
+glamor_prep_stage(glamor_screen_private *glamor_priv, PixmapPtr pixmap,
+                  glamor_pixmap_private *priv, int y1, int y2, Bool first)
+{
+    uint8_t *map = pixmap->devPrivate.ptr;
+    size_t size = (size_t) pixmap->devKind * pixmap->drawable.height;
+    size_t offset, len;
+
+    if (!map)
+        return;
+
+    if (first) {
+        if (glamor_priv->prep_staging < 0 &&
+            size >= GLAMOR_STAGING_PROBE_BYTES)
+            glamor_priv->prep_staging = glamor_prep_probe_staging(map);
+        if (glamor_priv->prep_staging <= 0)
+            return;
+
+        priv->staging = malloc(size);
+        if (priv->map_access == GLAMOR_ACCESS_RW)
+            priv->staging_clean = malloc(size);
+        if (!priv->staging ||
+            (priv->map_access == GLAMOR_ACCESS_RW && !priv->staging_clean)) {
+            /* Run fb on the mapping after all */
+            free(priv->staging);
+            free(priv->staging_clean);
+            priv->staging = priv->staging_clean = NULL;
+            return;
+        }
+    } else if (!priv->staging)
+        return;
+
+    y1 = MAX(y1, 0);
+    y2 = MIN(y2, pixmap->drawable.height);
+    if (y1 < y2) {
+        offset = (size_t) y1 * pixmap->devKind;
+        len = (size_t) (y2 - y1) * pixmap->devKind;
+        glamor_stream_copy(priv->staging + offset, map + offset, len);
+        if (priv->staging_clean)
+            memcpy(priv->staging_clean + offset, priv->staging + offset, len);
+    }
+
+    pixmap->devPrivate.ptr = priv->staging;
+}
+
+/*
+ * Upload the rows of the prepared region that fb changed, straight
+ * from the staging copy
+ */
+static void
+glamor_prep_upload_staged(glamor_screen_private *glamor_priv,
+                          PixmapPtr pixmap, glamor_pixmap_private *priv)
+{
+    int cpp = pixmap->drawable.bitsPerPixel >> 3;
+    int stride = pixmap->devKind;
+    BoxPtr box = RegionRects(&priv->prepare_region);
+    int nbox = RegionNumRects(&priv->prepare_region);
+    BoxRec dirty[32];
+    int ndirty = 0;
+    int y, start;
+
+    for (; nbox--; box++) {
+        int x1 = MAX(box->x1, 0);
+        int x2 = MIN(box->x2, pixmap->drawable.width);
+        int y1 = MAX(box->y1, 0);
+        int y2 = MIN(box->y2, pixmap->drawable.height);
+
+        if (x1 >= x2)
+            continue;
+
+        start = -1;
+        for (y = y1; y <= y2; y++) {
+            size_t offset = (size_t) y * stride + x1 * cpp;
+            Bool changed = y < y2 &&
+                memcmp(priv->staging + offset, priv->staging_clean + offset,
+                       (x2 - x1) * cpp) != 0;
+
+            if (y < y2)
+                glamor_priv->staging_rows++;
+
+            if (changed) {
+                glamor_priv->staging_dirty_rows++;
+                if (start < 0)
+                    start = y;
+                continue;
+            }
+
+            if (start < 0)
+                continue;
+
+            dirty[ndirty].x1 = x1;
+            dirty[ndirty].x2 = x2;
+            dirty[ndirty].y1 = start;
+            dirty[ndirty].y2 = y;
+            start = -1;
+            if (++ndirty == ARRAY_SIZE(dirty)) {
+                glamor_upload_boxes(pixmap, dirty, ndirty, 0, 0, 0, 0,
+                                    priv->staging, stride);
+                ndirty = 0;
+            }
+        }
+    }
+
+    if (ndirty)
+        glamor_upload_boxes(pixmap, dirty, ndirty, 0, 0, 0, 0,
+                            priv->staging, stride);
+}
+
+/*
+ * Bitmaps are converted on the CPU as they move, so they can't be
+ * read straight into a PBO
+ */
+static inline Bool
+glamor_prep_use_pbo(glamor_screen_private *glamor_priv, PixmapPtr pixmap)
+{
+    return glamor_priv->has_rw_pbo && pixmap->drawable.bitsPerPixel != 1;
+}
+
 /*
  * Make a pixmap ready to draw with fb by
  * creating a PBO large enough for the whole object
@@ -38,12 +285,26 @@ glamor_prep_pixmap_box(PixmapPtr pixmap, glamor_access_t access, BoxPtr box)
     glamor_pixmap_private       *priv = glamor_get_pixmap_private(pixmap);
     int                         gl_access, gl_usage;
     RegionRec                   region;
+    Bool                        first = TRUE;
+    Bool                        prefetched = FALSE;
+    int                         y1, y2;
 
     if (priv->type == GLAMOR_DRM_ONLY)
         return FALSE;
 
-    if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(priv))
+    if (!glamor_pixmap_thaw(pixmap))
+        return FALSE;
+
+    /* fb writes land in the FBO when finished */
+    if (access == GLAMOR_ACCESS_RW && !glamor_pixmap_unshare(pixmap))
+        return FALSE;
+
+    if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(priv)) {
+        /* Keep textures cached from memory pixmaps up to date */
+        if (access != GLAMOR_ACCESS_RO)
+            glamor_pixmap_invalidate(priv);
         return TRUE;
+    }
 
     glamor_make_current(glamor_priv);
 
@@ -74,6 +335,8 @@ glamor_prep_pixmap_box(PixmapPtr pixmap, glamor_access_t access, BoxPtr box)
         if (access == GLAMOR_ACCESS_RW)
             FatalError("attempt to remap buffer as writable");
 
+        first = FALSE;
+
         if (priv->pbo) {
             glBindBuffer(GL_PIXEL_PACK_BUFFER, priv->pbo);
             glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
@@ -82,16 +345,22 @@ glamor_prep_pixmap_box(PixmapPtr pixmap, glamor_access_t access, BoxPtr box)
     } else {
         RegionInit(&priv->prepare_region, box, 1);
 
-        if (glamor_priv->has_rw_pbo) {
+        if (glamor_prep_use_pbo(glamor_priv, pixmap)) {
+            /* Already read back if the fallback was seen coming */
+            if (priv->pbo == 0) {
+                priv->pbo = glamor_prefetch_take(pixmap, priv, box);
+                prefetched = priv->pbo != 0;
+            }
             if (priv->pbo == 0)
                 glGenBuffers(1, &priv->pbo);
 
             gl_usage = GL_STREAM_READ;
 
             glBindBuffer(GL_PIXEL_PACK_BUFFER, priv->pbo);
-            glBufferData(GL_PIXEL_PACK_BUFFER,
-                         pixmap->devKind * pixmap->drawable.height, NULL,
-                         gl_usage);
+            if (!prefetched)
+                glBufferData(GL_PIXEL_PACK_BUFFER,
+                             pixmap->devKind * pixmap->drawable.height, NULL,
+                             gl_usage);
         } else {
             pixmap->devPrivate.ptr = xallocarray(pixmap->devKind,
                                                  pixmap->drawable.height);
@@ -101,12 +370,20 @@ glamor_prep_pixmap_box(PixmapPtr pixmap, glamor_access_t access, BoxPtr box)
         priv->map_access = access;
     }
 
-    glamor_download_boxes(pixmap, RegionRects(&region), RegionNumRects(&region),
-                          0, 0, 0, 0, pixmap->devPrivate.ptr, pixmap->devKind);
+    glamor_trace_begin(GLAMOR_TRACE_PREPARE,
+                       RegionExtents(&region)->x2 - RegionExtents(&region)->x1,
+                       RegionExtents(&region)->y2 - RegionExtents(&region)->y1);
+
+    if (!prefetched)
+        glamor_download_boxes(pixmap, RegionRects(&region),
+                              RegionNumRects(&region), 0, 0, 0, 0,
+                              pixmap->devPrivate.ptr, pixmap->devKind);
 
+    y1 = RegionExtents(&region)->y1;
+    y2 = RegionExtents(&region)->y2;
     RegionUninit(&region);
 
-    if (glamor_priv->has_rw_pbo) {
+    if (glamor_prep_use_pbo(glamor_priv, pixmap)) {
         if (priv->map_access == GLAMOR_ACCESS_RW)
             gl_access = GL_READ_WRITE;
         else
@@ -114,8 +391,12 @@ glamor_prep_pixmap_box(PixmapPtr pixmap, glamor_access_t access, BoxPtr box)
 
         pixmap->devPrivate.ptr = glMapBuffer(GL_PIXEL_PACK_BUFFER, gl_access);
         glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        glamor_prep_stage(glamor_priv, pixmap, priv, y1, y2, first);
     }
 
+    glamor_trace_end(GLAMOR_TRACE_PREPARE);
+
     priv->prepared = TRUE;
     return TRUE;
 }
@@ -131,6 +412,7 @@ glamor_fini_pixmap(PixmapPtr pixmap)
     ScreenPtr                   screen = pixmap->drawable.pScreen;
     glamor_screen_private       *glamor_priv = glamor_get_screen_private(screen);
     glamor_pixmap_private       *priv = glamor_get_pixmap_private(pixmap);
+    Bool                        kept = FALSE;
 
     if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(priv))
         return;
@@ -138,24 +420,49 @@ glamor_fini_pixmap(PixmapPtr pixmap)
     if (!priv->prepared)
         return;
 
-    if (glamor_priv->has_rw_pbo) {
+    glamor_trace_begin(GLAMOR_TRACE_FINISH,
+                       RegionExtents(&priv->prepare_region)->x2 -
+                       RegionExtents(&priv->prepare_region)->x1,
+                       RegionExtents(&priv->prepare_region)->y2 -
+                       RegionExtents(&priv->prepare_region)->y1);
+
+    if (glamor_prep_use_pbo(glamor_priv, pixmap)) {
         glBindBuffer(GL_PIXEL_UNPACK_BUFFER, priv->pbo);
         glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
         pixmap->devPrivate.ptr = NULL;
     }
 
     if (priv->map_access == GLAMOR_ACCESS_RW) {
-        glamor_upload_boxes(pixmap,
-                            RegionRects(&priv->prepare_region),
-                            RegionNumRects(&priv->prepare_region),
-                            0, 0, 0, 0, pixmap->devPrivate.ptr, pixmap->devKind);
+        if (priv->staging) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glamor_prep_upload_staged(glamor_priv, pixmap, priv);
+        } else {
+            glamor_upload_boxes(pixmap,
+                                RegionRects(&priv->prepare_region),
+                                RegionNumRects(&priv->prepare_region),
+                                0, 0, 0, 0, pixmap->devPrivate.ptr,
+                                pixmap->devKind);
+        }
     }
 
+    /* The PBO matches the pixmap now, unless fb drew to the staging
+     * copy instead; it may save the next fallback a readback */
+    if (glamor_prep_use_pbo(glamor_priv, pixmap) &&
+        !(priv->map_access == GLAMOR_ACCESS_RW && priv->staging) &&
+        RegionNumRects(&priv->prepare_region) == 1)
+        kept = glamor_prefetch_keep(pixmap, priv, priv->pbo,
+                                    RegionExtents(&priv->prepare_region));
+
     RegionUninit(&priv->prepare_region);
 
-    if (glamor_priv->has_rw_pbo) {
+    free(priv->staging);
+    free(priv->staging_clean);
+    priv->staging = priv->staging_clean = NULL;
+
+    if (glamor_prep_use_pbo(glamor_priv, pixmap)) {
         glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
-        glDeleteBuffers(1, &priv->pbo);
+        if (!kept)
+            glDeleteBuffers(1, &priv->pbo);
         priv->pbo = 0;
     } else {
         free(pixmap->devPrivate.ptr);
@@ -163,6 +470,8 @@ glamor_fini_pixmap(PixmapPtr pixmap)
     }
 
     priv->prepared = FALSE;
+
+    glamor_trace_end(GLAMOR_TRACE_FINISH);
 }
 
 Bool
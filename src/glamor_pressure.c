@@ -0,0 +1,309 @@
+/*
+ * Copyright © 2014 Keith Packard
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include "glamor_priv.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <unistd.h>
+
+/*
+ * Giving memory back under memory pressure.
+ *
+ * Linux PSI triggers on the memory.pressure file of our cgroup, or
+ * /proc/pressure/memory without one, report when tasks stall waiting
+ * for memory, and the cgroup memory.events counters when the cgroup
+ * hits its high or max limits. The block handler looks at them at
+ * most once a second and responds in tiers:
+ *
+ *  1. some tasks stalling: free caches (GetImage, fallback PBOs,
+ *     trapezoid masks, glyph atlases)
+ *  2. all tasks stalling, or over memory.high: also compress every
+ *     cold tier candidate and free its FBO
+ *  3. memory.max or the OOM killer hit: also shrink the VBO
+ *
+ * A tier isn't repeated until GLAMOR_PRESSURE_HOLDOFF_MS has passed,
+ * unless a higher one comes along. GLAMOR_NO_PRESSURE disables all
+ * this; GLAMOR_PRESSURE_SIMULATE names a file holding a tier number,
+ * read in place of the kernel signals for testing.
+ */
+
+#define GLAMOR_PRESSURE_INTERVAL_MS     1000
+#define GLAMOR_PRESSURE_HOLDOFF_MS      10000
+
+/* Stall time per window, in us; unprivileged triggers need the
+ * window to be a multiple of 2s */
+#define GLAMOR_PRESSURE_SOME            "some 150000 2000000"
+#define GLAMOR_PRESSURE_FULL            "full 50000 2000000"
+
+static int
+glamor_pressure_trigger(const char *path, const char *trigger)
+{
+    int fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+
+    if (fd < 0)
+        return -1;
+    if (write(fd, trigger, strlen(trigger) + 1) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Sum of the memory.events counters showing we hit a limit: 'high'
+ * in *high, 'max' and 'oom_kill' in *max.
+ */
+static Bool
+glamor_pressure_read_events(int fd, uint64_t *high, uint64_t *max)
+{
+    char buf[512], *line, *save;
+    unsigned long long value;
+    char name[32];
+    ssize_t len;
+
+    len = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (len <= 0)
+        return FALSE;
+    buf[len] = '\0';
+
+    *high = *max = 0;
+    for (line = strtok_r(buf, "\n", &save); line;
+         line = strtok_r(NULL, "\n", &save)) {
+        if (sscanf(line, "%31s %llu", name, &value) != 2)
+            continue;
+        if (!strcmp(name, "high"))
+            *high += value;
+        else if (!strcmp(name, "max") || !strcmp(name, "oom_kill"))
+            *max += value;
+    }
+    return TRUE;
+}
+
+/*
+ * Find our cgroup v2 directory from /proc/self/cgroup
+ */
+static char *
+glamor_pressure_cgroup(void)
+{
+    char line[PATH_MAX], *dir = NULL;
+    FILE *f = fopen("/proc/self/cgroup", "r");
+
+    if (!f)
+        return NULL;
+
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "0::", 3))
+            continue;
+        line[strcspn(line, "\n")] = '\0';
+        if (asprintf(&dir, "/sys/fs/cgroup%s", line + 3) < 0)
+            dir = NULL;
+        break;
+    }
+    fclose(f);
+    return dir;
+}
+
+void
+glamor_pressure_init(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    char *simulate, *cgroup, *path;
+
+    glamor_priv->pressure_some_fd = -1;
+    glamor_priv->pressure_full_fd = -1;
+    glamor_priv->pressure_events_fd = -1;
+    glamor_priv->pressure_simulate = NULL;
+
+    if (getenv("GLAMOR_NO_PRESSURE"))
+        return;
+
+    simulate = getenv("GLAMOR_PRESSURE_SIMULATE");
+    if (simulate) {
+        glamor_priv->pressure_simulate = strdup(simulate);
+        return;
+    }
+
+    cgroup = glamor_pressure_cgroup();
+    if (cgroup && asprintf(&path, "%s/memory.pressure", cgroup) >= 0) {
+        glamor_priv->pressure_some_fd =
+            glamor_pressure_trigger(path, GLAMOR_PRESSURE_SOME);
+        glamor_priv->pressure_full_fd =
+            glamor_pressure_trigger(path, GLAMOR_PRESSURE_FULL);
+        free(path);
+    }
+    if (glamor_priv->pressure_some_fd < 0) {
+        glamor_priv->pressure_some_fd =
+            glamor_pressure_trigger("/proc/pressure/memory",
+                                    GLAMOR_PRESSURE_SOME);
+        glamor_priv->pressure_full_fd =
+            glamor_pressure_trigger("/proc/pressure/memory",
+                                    GLAMOR_PRESSURE_FULL);
+    }
+
+    if (cgroup && asprintf(&path, "%s/memory.events", cgroup) >= 0) {
+        glamor_priv->pressure_events_fd =
+            open(path, O_RDONLY | O_CLOEXEC);
+        if (glamor_priv->pressure_events_fd >= 0 &&
+            !glamor_pressure_read_events(glamor_priv->pressure_events_fd,
+                                         &glamor_priv->pressure_high,
+                                         &glamor_priv->pressure_max)) {
+            close(glamor_priv->pressure_events_fd);
+            glamor_priv->pressure_events_fd = -1;
+        }
+        free(path);
+    }
+    free(cgroup);
+
+    if (glamor_priv->pressure_some_fd < 0 &&
+        glamor_priv->pressure_events_fd < 0)
+        LogMessageVerb(X_INFO, 3,
+                       "glamor%d: no memory pressure information\n",
+                       screen->myNum);
+}
+
+void
+glamor_pressure_fini(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+
+    if (glamor_priv->pressure_some_fd >= 0)
+        close(glamor_priv->pressure_some_fd);
+    if (glamor_priv->pressure_full_fd >= 0)
+        close(glamor_priv->pressure_full_fd);
+    if (glamor_priv->pressure_events_fd >= 0)
+        close(glamor_priv->pressure_events_fd);
+    free(glamor_priv->pressure_simulate);
+
+    if (glamor_priv->pressure_responses[0])
+        LogMessageVerb(X_INFO, 3,
+                       "glamor%d: memory pressure: %lu cache trims, "
+                       "%lu cold demotions, %lu buffer shrinks\n",
+                       screen->myNum, glamor_priv->pressure_responses[0],
+                       glamor_priv->pressure_responses[1],
+                       glamor_priv->pressure_responses[2]);
+}
+
+/*
+ * Current pressure tier, 0 for none
+ */
+static int
+glamor_pressure_level(glamor_screen_private *glamor_priv)
+{
+    struct pollfd fds[2];
+    uint64_t high, max;
+    int level = 0, n = 0, i;
+    FILE *f;
+
+    if (glamor_priv->pressure_simulate) {
+        f = fopen(glamor_priv->pressure_simulate, "r");
+        if (f) {
+            if (fscanf(f, "%d", &level) != 1)
+                level = 0;
+            fclose(f);
+        }
+        return MIN(MAX(level, 0), 3);
+    }
+
+    if (glamor_priv->pressure_some_fd >= 0) {
+        fds[n].fd = glamor_priv->pressure_some_fd;
+        fds[n++].events = POLLPRI;
+    }
+    if (glamor_priv->pressure_full_fd >= 0) {
+        fds[n].fd = glamor_priv->pressure_full_fd;
+        fds[n++].events = POLLPRI;
+    }
+    if (n && poll(fds, n, 0) > 0) {
+        for (i = 0; i < n; i++) {
+            if (!(fds[i].revents & POLLPRI))
+                continue;
+            level = MAX(level, fds[i].fd == glamor_priv->pressure_full_fd ?
+                        2 : 1);
+        }
+    }
+
+    if (glamor_priv->pressure_events_fd >= 0 &&
+        glamor_pressure_read_events(glamor_priv->pressure_events_fd,
+                                    &high, &max)) {
+        if (max != glamor_priv->pressure_max)
+            level = 3;
+        else if (high != glamor_priv->pressure_high)
+            level = MAX(level, 2);
+        glamor_priv->pressure_high = high;
+        glamor_priv->pressure_max = max;
+    }
+
+    return level;
+}
+
+/*
+ * Called from the block handler
+ */
+void
+glamor_pressure_check(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    CARD32 now;
+    int level;
+
+    if (!glamor_priv->pressure_simulate &&
+        glamor_priv->pressure_some_fd < 0 &&
+        glamor_priv->pressure_events_fd < 0)
+        return;
+
+    now = GetTimeInMillis();
+    if (now - glamor_priv->pressure_check_time < GLAMOR_PRESSURE_INTERVAL_MS)
+        return;
+    glamor_priv->pressure_check_time = now;
+
+    if (now - glamor_priv->pressure_response_time >= GLAMOR_PRESSURE_HOLDOFF_MS)
+        glamor_priv->pressure_response_level = 0;
+
+    level = glamor_pressure_level(glamor_priv);
+    if (level <= glamor_priv->pressure_response_level)
+        return;
+
+    glamor_priv->pressure_response_level = level;
+    glamor_priv->pressure_response_time = now;
+
+    glamor_make_current(glamor_priv);
+
+    glamor_readback_flush(screen);
+    glamor_prefetch_flush(screen);
+    glamor_trap_cache_trim(screen);
+    glamor_composite_glyphs_trim(screen);
+    glamor_priv->pressure_responses[0]++;
+
+    if (level >= 2) {
+        glamor_cold_reclaim(screen, TRUE);
+        glamor_priv->pressure_responses[1]++;
+    }
+
+    if (level >= 3) {
+        glamor_trim_vbo(screen);
+        glamor_priv->pressure_responses[2]++;
+    }
+
+    /* Let the driver release the freed storage */
+    glFinish();
+}
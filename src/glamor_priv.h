@@ -121,6 +121,8 @@ enum shader_mask {
 enum shader_dest_swizzle {
     SHADER_DEST_SWIZZLE_DEFAULT,
     SHADER_DEST_SWIZZLE_ALPHA_TO_RED,
+    SHADER_DEST_SWIZZLE_DITHER_565,
+    SHADER_DEST_SWIZZLE_SWAP_RB,
     SHADER_DEST_SWIZZLE_COUNT,
 };
 
@@ -162,6 +164,49 @@ enum gradient_shader {
     SHADER_GRADIENT_COUNT,
 };
 
+/* Gradient programs kept for stop counts beyond the static ones */
+#define GLAMOR_GRADIENT_CACHE_SIZE 8
+
+/* Distinct operation names tracked by GLAMOR_VERIFY */
+#define GLAMOR_VERIFY_MAX_OPS 8
+
+/* Operations timed by glamor_dispatch_begin() */
+typedef enum {
+    GLAMOR_DISPATCH_FILL_RECT,
+    GLAMOR_DISPATCH_COPY,
+    GLAMOR_DISPATCH_PUT_IMAGE,
+    GLAMOR_DISPATCH_GET_IMAGE,
+    GLAMOR_DISPATCH_COMPOSITE,
+    GLAMOR_DISPATCH_NUM_OPS
+} glamor_dispatch_op;
+
+/* Size classes and pixmap placements each operation is timed for */
+#define GLAMOR_DISPATCH_SIZES           8
+#define GLAMOR_DISPATCH_RESIDENCIES     4
+
+typedef struct glamor_dispatch_bucket {
+    uint32_t gl_time;           /**< average, in 1/16us */
+    uint32_t fb_time;
+    uint16_t gl_samples;
+    uint16_t fb_samples;
+    Bool gl_failed;             /**< GL bailed on a probe; never timed again */
+    Bool use_fb;
+    unsigned int calls;
+} glamor_dispatch_bucket;
+
+/* Background work run while the server is idle, see glamor_idle.c */
+#define GLAMOR_IDLE_MAX_TASKS           8
+
+typedef struct glamor_idle_task {
+    const char *name;
+    Bool (*run)(ScreenPtr screen);  /**< one step, FALSE if nothing to do */
+    int budget;                 /**< us per idle period */
+    unsigned long steps;
+    unsigned long over_budget;  /**< steps alone longer than the budget */
+    uint64_t total_us;
+    uint64_t max_us;
+} glamor_idle_task;
+
 struct glamor_screen_private;
 struct glamor_pixmap_private;
 
@@ -193,6 +238,7 @@ struct glamor_saved_procs {
     SyncScreenFuncsRec sync_screen_funcs;
 #endif
     ScreenBlockHandlerProcPtr block_handler;
+    ScreenWakeupHandlerProcPtr wakeup_handler;
 };
 
 typedef struct glamor_screen_private {
@@ -217,6 +263,51 @@ typedef struct glamor_screen_private {
 
     GLuint one_channel_format;
 
+    /* depth 16 pixmaps stored as RGB565 textures */
+    Bool has_rgb565;
+    Bool dither;
+
+    /* depth 30 pixmaps stored as RGB10_A2 textures */
+    Bool has_rgb10_a2;
+
+    /* depth 1 pixmaps stored as one byte per pixel textures */
+    Bool gpu_bitmaps;
+
+    /* mipmapped minification of composite sources */
+    Bool has_mipmap;
+    size_t mipmap_budget;
+    size_t mipmap_size;
+    unsigned long mipmap_hits;
+    unsigned long mipmap_generations;
+    unsigned long mipmap_over_budget;
+    struct xorg_list mip_pixmaps;
+
+    /* stencil buffer clipping, GL_NONE if unavailable */
+    GLenum stencil_format;
+    unsigned long stencil_clip_draws;
+    unsigned long stencil_clip_updates;
+
+    /* GetImage cache, see glamor_readback.c */
+    struct xorg_list readback_list;
+    size_t readback_max;
+    size_t readback_size;
+    unsigned long readback_hits;
+    unsigned long readback_misses;
+    uint64_t readback_bytes_read;
+    uint64_t readback_bytes_served;
+
+    /* PBOs read back ahead of fallbacks, see glamor_prefetch.c */
+    struct xorg_list prefetch_list;
+    size_t prefetch_max;
+    size_t prefetch_size;
+    unsigned long prefetch_reads;
+    unsigned long prefetch_hits;
+    unsigned long prefetch_misses;
+
+    /* whole pixmap copies done by sharing the source FBO */
+    unsigned long fbo_shares;
+    unsigned long fbo_unshares;
+
     /* glamor point shader */
     glamor_program point_prog;
 
@@ -228,6 +319,7 @@ typedef struct glamor_screen_private {
 
     /* glamor glyphblt shaders */
     glamor_program_fill poly_glyph_blt_progs;
+    glamor_program      push_bitmap_prog;
 
     /* glamor text shaders */
     glamor_program_fill poly_text_progs;
@@ -244,6 +336,12 @@ typedef struct glamor_screen_private {
     /* glamor segment shaders */
     glamor_program_fill poly_segment_program;
 
+    /* glamor bitmap to region shader */
+    glamor_program      bitmap_region_prog;
+
+    /* glamor tile checksum shader */
+    glamor_program      tile_checksum_prog;
+
     /*  glamor dash line shader */
     glamor_program_fill on_off_dash_line_progs;
     glamor_program      double_dash_line_prog;
@@ -256,6 +354,67 @@ typedef struct glamor_screen_private {
     int                         glyph_max_dim;
     char                        *glyph_defines;
 
+    /* cold pixmap tier */
+    struct xorg_list cold_pixmaps;
+    int cold_timeout;
+    struct {
+        unsigned long frozen;
+        unsigned long thawed;
+        uint64_t raw_bytes;
+        uint64_t packed_bytes;
+        uint64_t freeze_us;
+        uint64_t thaw_us;
+    } cold_stats;
+
+    /* GLAMOR_VERIFY reference checks */
+    int verify_interval;
+    unsigned int verify_count;
+    struct glamor_verify_stats {
+        const char *name;
+        unsigned long checked;
+        unsigned long mismatched;
+        uint64_t gl_us;
+        uint64_t fb_us;
+    } verify_stats[GLAMOR_VERIFY_MAX_OPS];
+
+    /* fb staging for slow PBO mappings, -1 until probed */
+    int prep_staging;
+    uint64_t staging_rows;
+    uint64_t staging_dirty_rows;
+
+    /* GL versus fb choice, see glamor_dispatch.c */
+    Bool dispatch_enabled;
+    unsigned long dispatch_probes;
+    unsigned long dispatch_fb;
+    glamor_dispatch_bucket dispatch[GLAMOR_DISPATCH_NUM_OPS]
+                                   [GLAMOR_DISPATCH_SIZES]
+                                   [GLAMOR_DISPATCH_RESIDENCIES];
+
+    /* idle time scheduler, see glamor_idle.c */
+    glamor_idle_task idle_tasks[GLAMOR_IDLE_MAX_TASKS];
+    int idle_ntasks;
+    int idle_budget;            /* us per idle period, 0 disables */
+    int idle_delay;             /* ms asleep before the server is idle */
+    CARD32 idle_block_time;
+    CARD32 idle_slept;
+    CARD32 idle_last_run;
+    unsigned long idle_periods;
+
+    /* memory pressure signals, see glamor_pressure.c */
+    int pressure_some_fd;
+    int pressure_full_fd;
+    int pressure_events_fd;
+    char *pressure_simulate;
+    uint64_t pressure_high;
+    uint64_t pressure_max;
+    CARD32 pressure_check_time;
+    CARD32 pressure_response_time;
+    int pressure_response_level;
+    unsigned long pressure_responses[3];
+
+    /* glamor trapezoid mask cache */
+    struct glamor_trap_cache    *trap_cache;
+
     /** Vertex buffer for all GPU rendering. */
     GLuint vao;
     GLuint vbo;
@@ -285,12 +444,21 @@ typedef struct glamor_screen_private {
         [SHADER_MASK_COUNT]
         [glamor_program_alpha_count]
         [SHADER_DEST_SWIZZLE_COUNT];
+    int composite_warm_next;    /* next shader to build while idle */
 
     /* glamor gradient, 0 for small nstops, 1 for
-       large nstops and 2 for dynamic generate. */
-    GLint gradient_prog[SHADER_GRADIENT_COUNT][3];
-    int linear_max_nstops;
-    int radial_max_nstops;
+       large nstops; larger ones come from gradient_cache. */
+    GLint gradient_prog[SHADER_GRADIENT_COUNT][2];
+    struct glamor_gradient_cache_entry {
+        enum gradient_shader type;
+        int nstops;
+        GLint prog;
+        unsigned int last_use;
+    } gradient_cache[GLAMOR_GRADIENT_CACHE_SIZE];
+    unsigned int gradient_cache_clock;
+    unsigned long gradient_compiles;
+    unsigned long gradient_cache_hits;
+    unsigned long gradient_cache_evictions;
 
     int screen_fbo;
     struct glamor_saved_procs saved_procs;
@@ -331,6 +499,13 @@ typedef struct glamor_pixmap_fbo {
     int height; /**< height in pixels */
     GLenum format; /**< GL format used to create the texture. */
     GLenum type; /**< GL type used to create the texture. */
+    size_t mip_size; /**< bytes of mip levels generated, zero if none */
+    Bool swap_rb; /**< sampling swizzle swaps red and blue */
+    int shared; /**< number of other pixmaps using this fbo */
+    GLuint stencil; /**< stencil renderbuffer, see glamor_stencil.c */
+    RegionRec stencil_clip; /**< clip list held in the stencil buffer */
+    int stencil_x; /**< offset stencil_clip was drawn at */
+    int stencil_y;
 } glamor_pixmap_fbo;
 
 typedef struct glamor_pixmap_clipped_regions {
@@ -353,6 +528,9 @@ typedef struct glamor_pixmap_private {
     GLuint pbo;
     RegionRec prepare_region;
     Bool prepared;
+    /** cached copies of the PBO mapping, see glamor_prepare.c */
+    uint8_t *staging;
+    uint8_t *staging_clean;
     EGLImageKHR image;
 
     /** block width of this large pixmap. */
@@ -391,17 +569,165 @@ typedef struct glamor_pixmap_private {
      */
     glamor_pixmap_fbo **fbo_array;
     struct gbm_bo *bo;
+
+    /**
+     * Bumped whenever the pixmap contents may have changed, so that
+     * data cached from them can be validated cheaply.
+     */
+    unsigned int serial;
+
+    /** serial at which solid_pixel was read back, zero if never */
+    unsigned int solid_serial;
+    CARD32 solid_pixel;
+
+    /** serial at which the fbo mip levels were generated */
+    unsigned int mip_serial;
+    Bool mip_listed;            /**< on mip_pixmaps */
+    struct xorg_list mip_link;
+
+    /** texture holding a memory pixmap used as a tile, and the
+     * serial it was uploaded at */
+    glamor_pixmap_fbo *tile_fbo;
+    unsigned int tile_serial;
+    void *fb_bits;              /**< storage fb allocated with the pixmap */
+
+    /** cold tier state, see glamor_cold.c */
+    PixmapPtr cold_pixmap;      /**< set while tracked */
+    struct xorg_list cold_link;
+    unsigned int cold_epoch;    /**< last access time, in seconds */
+    char *cold_data;            /**< LZ4 compressed contents */
+    int cold_size;
+    void *cold_owned;           /**< memory storage if restoring failed */
+
+    /** checksums from glamor_pixmap_changed_tiles(), with the table
+     * size and the serial they were computed at */
+    uint32_t *tile_checksums;
+    int tile_checksum_w;
+    int tile_checksum_h;
+    unsigned int tile_checksum_serial;
+
+    /** GetImage cache, see glamor_readback.c */
+    struct glamor_readback *readback;
+    Bool readback_seen;         /**< GetImage has been called before */
+
+    /** PBO read back ahead of fallbacks, see glamor_prefetch.c */
+    GLuint prefetch_pbo;
+    BoxRec prefetch_box;        /**< area of it matching the pixmap */
+    unsigned int prefetch_serial;
+    size_t prefetch_size;
+    Bool prefetch_wanted;       /**< keep the PBO after fallbacks */
+    struct xorg_list prefetch_link;
 } glamor_pixmap_private;
 
+typedef struct glamor_readback {
+    PixmapPtr pixmap;
+    unsigned int serial;        /**< pixmap serial valid is up to date with */
+    RegionRec valid;            /**< areas of bits matching the pixmap */
+    uint8_t *bits;
+    uint32_t stride;
+    size_t size;
+    struct xorg_list link;      /**< in readback_list, oldest first */
+} glamor_readback;
+
 extern DevPrivateKeyRec glamor_pixmap_private_key;
 
+/* glamor_cold.c */
+#ifdef GLAMOR_HAS_LZ4
+extern unsigned int glamor_cold_epoch;
+
+void glamor_cold_init(ScreenPtr screen);
+void glamor_cold_fini(ScreenPtr screen);
+void glamor_cold_track(PixmapPtr pixmap, unsigned int usage);
+void glamor_cold_untrack(PixmapPtr pixmap);
+Bool glamor_cold_thaw(PixmapPtr pixmap);
+Bool glamor_cold_discard(PixmapPtr pixmap);
+int glamor_cold_reclaim(ScreenPtr screen, Bool force);
+#else
+static inline void glamor_cold_init(ScreenPtr screen) { }
+static inline void glamor_cold_fini(ScreenPtr screen) { }
+static inline void glamor_cold_track(PixmapPtr pixmap, unsigned int usage) { }
+static inline void glamor_cold_untrack(PixmapPtr pixmap) { }
+static inline Bool glamor_cold_discard(PixmapPtr pixmap) { return TRUE; }
+static inline int glamor_cold_reclaim(ScreenPtr screen, Bool force) { return 0; }
+#endif
+
 static inline glamor_pixmap_private *
 glamor_get_pixmap_private(PixmapPtr pixmap)
 {
+    glamor_pixmap_private *priv;
+
     if (pixmap == NULL)
         return NULL;
 
-    return dixLookupPrivate(&pixmap->devPrivates, &glamor_pixmap_private_key);
+    priv = dixLookupPrivate(&pixmap->devPrivates, &glamor_pixmap_private_key);
+    return priv;
+}
+
+/*
+ * Called where a pixmap is about to be drawn with or read: marks it
+ * as in use and brings it back from the cold tier. Returns FALSE if
+ * there wasn't the memory to.
+ */
+static inline Bool
+glamor_pixmap_thaw(PixmapPtr pixmap)
+{
+#ifdef GLAMOR_HAS_LZ4
+    glamor_pixmap_private *priv = glamor_get_pixmap_private(pixmap);
+
+    priv->cold_epoch = glamor_cold_epoch;
+    if (priv->cold_data)
+        return glamor_cold_thaw(pixmap);
+#endif
+    return TRUE;
+}
+
+/*
+ * Note that the pixmap contents may have changed, invalidating
+ * anything cached from them.
+ */
+static inline void
+glamor_pixmap_invalidate(glamor_pixmap_private *priv)
+{
+    if (++priv->serial == 0)
+        priv->serial = 1;
+}
+
+Bool glamor_pixmap_unshare_fbo(PixmapPtr pixmap, RegionPtr overwritten);
+void glamor_readback_damage(glamor_pixmap_private *priv, unsigned int serial,
+                            const BoxRec *damage);
+
+/*
+ * Called by drawing paths before they set anything up, while they can
+ * still fall back: a pixmap sharing its FBO with others gets a copy of
+ * its own. Returns FALSE if there is no memory for it.
+ */
+static inline Bool
+glamor_pixmap_unshare(PixmapPtr pixmap)
+{
+    glamor_pixmap_private *priv = glamor_get_pixmap_private(pixmap);
+
+    if (priv->fbo && priv->fbo->shared)
+        return glamor_pixmap_unshare_fbo(pixmap, NULL);
+    return TRUE;
+}
+
+/*
+ * Called before the pixmap's FBO is drawn to, with the area about to
+ * be drawn in pixmap coordinates if known. The caller has unshared
+ * the FBO already with glamor_pixmap_unshare(); this only catches
+ * paths that can't fail.
+ */
+static inline void
+glamor_pixmap_begin_write(PixmapPtr pixmap, glamor_pixmap_private *priv,
+                          const BoxRec *damage)
+{
+    unsigned int serial = priv->serial;
+
+    glamor_pixmap_invalidate(priv);
+    if (priv->readback)
+        glamor_readback_damage(priv, serial, damage);
+    if (priv->fbo && priv->fbo->shared)
+        glamor_pixmap_unshare_fbo(pixmap, NULL);
 }
 
 /*
@@ -581,6 +907,7 @@ glamor_picture_red_is_alpha(PicturePtr picture)
         glamor_get_screen_private(picture->pDrawable->pScreen)->one_channel_format == GL_RED;
 }
 
+void glamor_set_texture_swap_rb(glamor_pixmap_fbo *fbo, Bool swap);
 void glamor_bind_texture(glamor_screen_private *glamor_priv,
                          GLenum texture,
                          glamor_pixmap_fbo *fbo,
@@ -620,6 +947,145 @@ RegionPtr glamor_bitmap_to_region(PixmapPtr pixmap);
 void
 glamor_track_stipple(GCPtr gc);
 
+/* glamor_prepare.c */
+void glamor_prepare_init(ScreenPtr screen);
+
+/* glamor_readback.c */
+void glamor_readback_init(ScreenPtr screen);
+void glamor_readback_fini(ScreenPtr screen);
+void glamor_readback_free(PixmapPtr pixmap, glamor_pixmap_private *priv);
+Bool glamor_readback_get(PixmapPtr pixmap, const BoxRec *box,
+                         uint8_t *bits, uint32_t byte_stride);
+Bool glamor_readback_trim(ScreenPtr screen);
+void glamor_readback_flush(ScreenPtr screen);
+
+/* glamor_prefetch.c */
+void glamor_prefetch_init(ScreenPtr screen);
+void glamor_prefetch_fini(ScreenPtr screen);
+void glamor_prefetch_free(PixmapPtr pixmap, glamor_pixmap_private *priv);
+void glamor_prefetch_flush(ScreenPtr screen);
+Bool glamor_prefetch_trim(ScreenPtr screen);
+void glamor_prefetch_gc(GCPtr gc, DrawablePtr drawable);
+void glamor_prefetch_picture(PicturePtr picture);
+GLuint glamor_prefetch_take(PixmapPtr pixmap, glamor_pixmap_private *priv,
+                            const BoxRec *box);
+Bool glamor_prefetch_keep(PixmapPtr pixmap, glamor_pixmap_private *priv,
+                          GLuint pbo, const BoxRec *box);
+
+/* glamor_pressure.c */
+void glamor_pressure_init(ScreenPtr screen);
+void glamor_pressure_fini(ScreenPtr screen);
+void glamor_pressure_check(ScreenPtr screen);
+
+/* glamor_trace.c */
+typedef enum glamor_trace_point {
+    GLAMOR_TRACE_COMPOSITE,
+    GLAMOR_TRACE_COPY,
+    GLAMOR_TRACE_PUT_IMAGE,
+    GLAMOR_TRACE_GET_IMAGE,
+    GLAMOR_TRACE_PREPARE,
+    GLAMOR_TRACE_FINISH,
+    GLAMOR_TRACE_VBO,
+    GLAMOR_TRACE_FLUSH,
+    GLAMOR_TRACE_COMPILE,
+    GLAMOR_TRACE_LINK,
+    GLAMOR_TRACE_NUM_POINTS
+} glamor_trace_point;
+
+typedef struct glamor_trace_event {
+    uint64_t seq;               /**< index + 1 once completely written */
+    uint64_t time;              /**< us */
+    int32_t client;             /**< index, -1 if none */
+    int32_t arg0, arg1;         /**< sizes, see glamor_trace_points */
+    uint8_t point;
+    char phase;                 /**< 'B'egin or 'E'nd */
+} glamor_trace_event;
+
+/* NULL unless tracing */
+extern glamor_trace_event *glamor_trace_ring;
+
+void glamor_trace_init(void);
+void glamor_trace_fini(void);
+void glamor_trace_block(void);
+void glamor_trace_record(glamor_trace_point point, char phase,
+                         int arg0, int arg1);
+
+static inline void
+glamor_trace_begin(glamor_trace_point point, int arg0, int arg1)
+{
+    if (_X_UNLIKELY(glamor_trace_ring != NULL))
+        glamor_trace_record(point, 'B', arg0, arg1);
+}
+
+static inline void
+glamor_trace_end(glamor_trace_point point)
+{
+    if (_X_UNLIKELY(glamor_trace_ring != NULL))
+        glamor_trace_record(point, 'E', 0, 0);
+}
+
+/* glamor_idle.c */
+void glamor_idle_init(ScreenPtr screen);
+void glamor_idle_fini(ScreenPtr screen);
+Bool glamor_idle_add_task(ScreenPtr screen, const char *name,
+                          Bool (*run)(ScreenPtr screen), int budget);
+void glamor_idle_block(ScreenPtr screen, void *timeout);
+void glamor_idle_wakeup(ScreenPtr screen, int result);
+
+/* glamor_region.c */
+RegionPtr glamor_bitmap_to_region_gl(PixmapPtr bitmap);
+
+/* glamor_checksum.c */
+void glamor_checksum_free(glamor_pixmap_private *priv);
+
+/* glamor_stencil.c */
+void glamor_stencil_init(ScreenPtr screen);
+void glamor_stencil_fini_fbo(glamor_pixmap_fbo *fbo);
+int glamor_stencil_clip(DrawablePtr drawable, RegionPtr clip,
+                        int off_x, int off_y, int nprim, BoxPtr *boxes);
+void glamor_stencil_clip_done(ScreenPtr screen);
+
+/* glamor_threads.c */
+typedef void (*glamor_stripe_func)(void *closure, int y1, int y2);
+
+void glamor_threads_init(void);
+void glamor_threads_fini(void);
+void glamor_run_stripes(glamor_stripe_func func, void *closure,
+                        int height, size_t bytes);
+
+/* glamor_dispatch.c */
+typedef struct glamor_dispatch {
+    int probe;                  /**< which path is being timed, if any */
+    glamor_screen_private *glamor_priv;
+    glamor_dispatch_bucket *bucket;
+    CARD64 start;
+} glamor_dispatch;
+
+void glamor_dispatch_init(ScreenPtr screen);
+void glamor_dispatch_fini(ScreenPtr screen);
+Bool glamor_dispatch_begin(glamor_dispatch *dispatch, glamor_dispatch_op op,
+                           DrawablePtr dst, DrawablePtr src, uint64_t area);
+void glamor_dispatch_end(glamor_dispatch *dispatch, Bool gl);
+
+/* glamor_verify.c */
+typedef struct glamor_verify {
+    PixmapPtr pixmap;           /**< NULL when this operation isn't checked */
+    BoxRec box;
+    uint8_t *before;
+    uint8_t *result;
+    int stride;
+    CARD64 start;
+    CARD64 gl_us;
+    Bool checked;
+} glamor_verify;
+
+void glamor_verify_init(ScreenPtr screen);
+void glamor_verify_fini(ScreenPtr screen);
+void glamor_verify_begin(DrawablePtr drawable, const BoxRec *boxes, int nbox,
+                         glamor_verify *verify);
+Bool glamor_verify_check(glamor_verify *verify);
+void glamor_verify_end(glamor_verify *verify, const char *name);
+
 /* glamor_render.c */
 Bool glamor_composite_clipped_region(CARD8 op,
                                      PicturePtr source,
@@ -647,15 +1113,20 @@ void glamor_composite(CARD8 op,
 void glamor_composite_rects(CARD8 op,
                             PicturePtr pDst,
                             xRenderColor *color, int nRect, xRectangle *rects);
+Bool glamor_composite_warm_shaders(ScreenPtr screen);
+Bool glamor_composite_refresh_mipmaps(ScreenPtr screen);
 
 /* glamor_trapezoid.c */
 void glamor_trapezoids(CARD8 op,
                        PicturePtr src, PicturePtr dst,
                        PictFormatPtr mask_format, INT16 x_src, INT16 y_src,
                        int ntrap, xTrapezoid *traps);
+void glamor_trap_cache_fini(ScreenPtr screen);
+void glamor_trap_cache_trim(ScreenPtr screen);
 
 /* glamor_gradient.c */
 void glamor_init_gradient_shader(ScreenPtr screen);
+void glamor_fini_gradient_shader(ScreenPtr screen);
 PicturePtr glamor_generate_linear_gradient_picture(ScreenPtr screen,
                                                    PicturePtr src_picture,
                                                    int x_source, int y_source,
@@ -683,6 +1154,7 @@ void glamor_pixmap_fini(ScreenPtr screen);
 
 void glamor_init_vbo(ScreenPtr screen);
 void glamor_fini_vbo(ScreenPtr screen);
+void glamor_trim_vbo(ScreenPtr screen);
 
 void *
 glamor_get_vbo_space(ScreenPtr screen, unsigned size, char **vbo_offset);
@@ -845,6 +1317,9 @@ glamor_composite_glyphs_init(ScreenPtr pScreen);
 void
 glamor_composite_glyphs_fini(ScreenPtr pScreen);
 
+void
+glamor_composite_glyphs_trim(ScreenPtr pScreen);
+
 void
 glamor_composite_glyphs(CARD8 op,
                         PicturePtr src,
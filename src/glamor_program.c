@@ -46,11 +46,43 @@ use_tile(PixmapPtr pixmap, GCPtr gc, glamor_program *prog, void *arg)
 static const glamor_facet glamor_fill_tile = {
     .name = "tile",
     .vs_exec =  "       fill_pos = (fill_offset + primitive.xy + pos) * fill_size_inv;\n",
-    .fs_exec =  "       gl_FragColor = texture2D(sampler, fill_pos);\n",
+    .fs_exec =  "       gl_FragColor = texture2D(sampler, fract(fill_pos));\n",
     .locations = glamor_program_location_fillsamp | glamor_program_location_fillpos,
     .use = use_tile,
 };
 
+static Bool
+use_tile_array(PixmapPtr pixmap, GCPtr gc, glamor_program *prog, void *arg)
+{
+    return glamor_set_tile_array(pixmap, gc, prog->fill_offset_uniform,
+                                 prog->fill_size_inv_uniform,
+                                 prog->tile_block_uniform,
+                                 prog->tiles_uniform);
+}
+
+/*
+ * A tile made of up to 2x2 FBOs. tile_block is where the first
+ * column and row end, as a fraction of the tile size; the position
+ * within the tile picks the FBO and is rescaled to its size.
+ */
+static const glamor_facet glamor_fill_tile_array = {
+    .name = "tile_array",
+    .vs_exec =  "       fill_pos = (fill_offset + primitive.xy + pos) * fill_size_inv;\n",
+    .fs_exec = ("       vec2 tile_pos = fract(fill_pos);\n"
+                "       vec2 block = step(tile_block, tile_pos);\n"
+                "       vec2 block_pos = (tile_pos - block * tile_block) /\n"
+                "               mix(tile_block, 1.0 - tile_block, block);\n"
+                "       vec4 top = mix(texture2D(sampler, block_pos),\n"
+                "                      texture2D(tiles[0], block_pos), block.x);\n"
+                "       vec4 bottom = mix(texture2D(tiles[1], block_pos),\n"
+                "                         texture2D(tiles[2], block_pos), block.x);\n"
+                "       gl_FragColor = mix(top, bottom, block.y);\n"),
+    .locations = (glamor_program_location_fillsamp |
+                  glamor_program_location_fillpos |
+                  glamor_program_location_tile_array),
+    .use = use_tile_array,
+};
+
 static Bool
 use_stipple(PixmapPtr pixmap, GCPtr gc, glamor_program *prog, void *arg)
 {
@@ -62,7 +94,7 @@ use_stipple(PixmapPtr pixmap, GCPtr gc, glamor_program *prog, void *arg)
 static const glamor_facet glamor_fill_stipple = {
     .name = "stipple",
     .vs_exec =  "       fill_pos = (fill_offset + primitive.xy + pos) * fill_size_inv;\n",
-    .fs_exec = ("       float a = texture2D(sampler, fill_pos).w;\n"
+    .fs_exec = ("       float a = texture2D(sampler, fract(fill_pos)).w;\n"
                 "       if (a == 0.0)\n"
                 "               discard;\n"
                 "       gl_FragColor = fg;\n"),
@@ -82,7 +114,7 @@ use_opaque_stipple(PixmapPtr pixmap, GCPtr gc, glamor_program *prog, void *arg)
 static const glamor_facet glamor_fill_opaque_stipple = {
     .name = "opaque_stipple",
     .vs_exec =  "       fill_pos = (fill_offset + primitive.xy + pos) * fill_size_inv;\n",
-    .fs_exec = ("       float a = texture2D(sampler, fill_pos).w;\n"
+    .fs_exec = ("       float a = texture2D(sampler, fract(fill_pos)).w;\n"
                 "       if (a == 0.0)\n"
                 "               gl_FragColor = bg;\n"
                 "       else\n"
@@ -91,11 +123,12 @@ static const glamor_facet glamor_fill_opaque_stipple = {
     .use = use_opaque_stipple
 };
 
-static const glamor_facet *glamor_facet_fill[4] = {
+static const glamor_facet *glamor_facet_fill[GLAMOR_FILL_TILE_ARRAY + 1] = {
     &glamor_fill_solid,
     &glamor_fill_tile,
     &glamor_fill_stipple,
     &glamor_fill_opaque_stipple,
+    &glamor_fill_tile_array,
 };
 
 typedef struct {
@@ -142,6 +175,11 @@ static glamor_location_var location_vars[] = {
         .location = glamor_program_location_atlas,
         .fs_vars = "uniform sampler2D atlas;\n",
     },
+    {
+        .location = glamor_program_location_tile_array,
+        .fs_vars = ("uniform sampler2D tiles[3];\n"
+                    "uniform vec2 tile_block;\n"),
+    },
 };
 
 static char *
@@ -361,6 +399,8 @@ glamor_build_program(ScreenPtr          screen,
     prog->dash_uniform = glamor_get_uniform(prog, glamor_program_location_dash, "dash");
     prog->dash_length_uniform = glamor_get_uniform(prog, glamor_program_location_dash, "dash_length");
     prog->atlas_uniform = glamor_get_uniform(prog, glamor_program_location_atlas, "atlas");
+    prog->tile_block_uniform = glamor_get_uniform(prog, glamor_program_location_tile_array, "tile_block");
+    prog->tiles_uniform = glamor_get_uniform(prog, glamor_program_location_tile_array, "tiles");
 
     free(version_string);
     free(fs_vars);
@@ -384,6 +424,9 @@ glamor_use_program(PixmapPtr            pixmap,
                    glamor_program       *prog,
                    void                 *arg)
 {
+    if (!glamor_pixmap_unshare(pixmap))
+        return FALSE;
+
     glUseProgram(prog->prog);
 
     if (prog->prim_use && !prog->prim_use(pixmap, gc, prog, arg))
@@ -402,11 +445,16 @@ glamor_use_program_fill(PixmapPtr               pixmap,
                         const glamor_facet      *prim)
 {
     ScreenPtr                   screen = pixmap->drawable.pScreen;
-    glamor_program              *prog = &program_fill->progs[gc->fillStyle];
+    glamor_program              *prog;
 
     int                         fill_style = gc->fillStyle;
     const glamor_facet          *fill;
 
+    if (fill_style == FillTiled && glamor_pixmap_is_large(gc->tile.pixmap))
+        fill_style = GLAMOR_FILL_TILE_ARRAY;
+
+    prog = &program_fill->progs[fill_style];
+
     if (prog->failed)
         return FALSE;
 
@@ -677,6 +725,9 @@ glamor_use_program_render(glamor_program        *prog,
                           PicturePtr            src,
                           PicturePtr            dst)
 {
+    if (!glamor_pixmap_unshare(glamor_get_drawable_pixmap(dst->pDrawable)))
+        return FALSE;
+
     glUseProgram(prog->prog);
 
     if (prog->prim_use_render && !prog->prim_use_render(op, src, dst, prog))
@@ -33,6 +33,7 @@ typedef enum {
     glamor_program_location_bitplane = 32,
     glamor_program_location_dash = 64,
     glamor_program_location_atlas = 128,
+    glamor_program_location_tile_array = 256,
 } glamor_program_location;
 
 typedef enum {
@@ -83,6 +84,8 @@ struct _glamor_program {
     GLint                       dash_uniform;
     GLint                       dash_length_uniform;
     GLint                       atlas_uniform;
+    GLint                       tile_block_uniform;
+    GLint                       tiles_uniform;
     glamor_program_location     locations;
     glamor_program_flag         flags;
     glamor_use                  prim_use;
@@ -92,8 +95,11 @@ struct _glamor_program {
     glamor_use_render           fill_use_render;
 };
 
+/* Used in place of FillTiled for tiles split across several FBOs */
+#define GLAMOR_FILL_TILE_ARRAY  (FillOpaqueStippled + 1)
+
 typedef struct {
-    glamor_program      progs[4];
+    glamor_program      progs[GLAMOR_FILL_TILE_ARRAY + 1];
 } glamor_program_fill;
 
 extern const glamor_facet glamor_fill_solid;
@@ -0,0 +1,301 @@
+/*
+ * Copyright © 2014 Keith Packard
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include "glamor_priv.h"
+#include "glamor_transfer.h"
+
+/*
+ * Cache of pixmap contents read back for GetImage.
+ *
+ * Screen scrapers call GetImage on the same areas over and over, most
+ * of which haven't changed since the last time. Pixmaps read more
+ * than once get a CPU copy of their contents along with the region of
+ * it known to be current. GetImage reads back only what is missing
+ * from that region and serves the rest from memory.
+ *
+ * Writes to the pixmap go through glamor_pixmap_begin_write(), which
+ * removes the area being drawn from the valid region when it is
+ * known. Any other change to the pixmap serial throws the whole cache
+ * away the next time it is used.
+ *
+ * Caches are kept in least recently used order and freed once their
+ * total size passes GLAMOR_READBACK_CACHE megabytes, 0 disabling the
+ * cache entirely.
+ */
+
+#define GLAMOR_READBACK_CACHE_DEFAULT   64
+
+void
+glamor_readback_init(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    char *cache_string;
+    int megabytes = GLAMOR_READBACK_CACHE_DEFAULT;
+
+    cache_string = getenv("GLAMOR_READBACK_CACHE");
+    if (cache_string && sscanf(cache_string, "%d", &megabytes) != 1)
+        megabytes = GLAMOR_READBACK_CACHE_DEFAULT;
+
+    xorg_list_init(&glamor_priv->readback_list);
+    glamor_priv->readback_max = (size_t) MAX(megabytes, 0) << 20;
+}
+
+static void
+glamor_readback_destroy(glamor_screen_private *glamor_priv,
+                        glamor_pixmap_private *priv)
+{
+    glamor_readback *readback = priv->readback;
+
+    xorg_list_del(&readback->link);
+    glamor_priv->readback_size -= readback->size;
+    RegionUninit(&readback->valid);
+    free(readback->bits);
+    free(readback);
+    priv->readback = NULL;
+}
+
+/*
+ * Free every cache, on close or under memory pressure
+ */
+void
+glamor_readback_flush(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_readback *readback, *tmp;
+
+    xorg_list_for_each_entry_safe(readback, tmp, &glamor_priv->readback_list,
+                                  link)
+        glamor_readback_destroy(glamor_priv,
+                                glamor_get_pixmap_private(readback->pixmap));
+}
+
+void
+glamor_readback_fini(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+
+    glamor_readback_flush(screen);
+
+    if (glamor_priv->readback_hits || glamor_priv->readback_misses)
+        LogMessageVerb(X_INFO, 3,
+                       "glamor%d: GetImage cache: %lu hits, %lu misses, "
+                       "%llu bytes read back, %llu bytes served\n",
+                       screen->myNum, glamor_priv->readback_hits,
+                       glamor_priv->readback_misses,
+                       (unsigned long long) glamor_priv->readback_bytes_read,
+                       (unsigned long long) glamor_priv->readback_bytes_served);
+}
+
+/*
+ * Free the cache of a pixmap being destroyed
+ */
+void
+glamor_readback_free(PixmapPtr pixmap, glamor_pixmap_private *priv)
+{
+    if (priv->readback)
+        glamor_readback_destroy(glamor_get_screen_private(pixmap->drawable.pScreen),
+                                priv);
+}
+
+/*
+ * Called by glamor_pixmap_begin_write() after bumping the serial from
+ * 'serial'. 'damage' is the area about to be drawn, in pixmap
+ * coordinates, or NULL if it isn't known.
+ */
+void
+glamor_readback_damage(glamor_pixmap_private *priv, unsigned int serial,
+                       const BoxRec *damage)
+{
+    glamor_readback *readback = priv->readback;
+    RegionRec region;
+
+    /* Already out of date, or about to be */
+    if (readback->serial != serial || !damage)
+        return;
+
+    RegionInit(&region, (BoxPtr) damage, 1);
+    if (!RegionSubtract(&readback->valid, &readback->valid, &region))
+        RegionEmpty(&readback->valid);
+    RegionUninit(&region);
+
+    readback->serial = priv->serial;
+}
+
+static glamor_readback *
+glamor_readback_create(glamor_screen_private *glamor_priv,
+                       PixmapPtr pixmap, glamor_pixmap_private *priv)
+{
+    glamor_readback *readback;
+    uint32_t stride = PixmapBytePad(pixmap->drawable.width,
+                                    pixmap->drawable.depth);
+    size_t size = (size_t) stride * pixmap->drawable.height;
+
+    if (size > glamor_priv->readback_max)
+        return NULL;
+
+    /* Make room, oldest first */
+    while (glamor_priv->readback_size + size > glamor_priv->readback_max) {
+        glamor_readback *victim =
+            xorg_list_first_entry(&glamor_priv->readback_list,
+                                  glamor_readback, link);
+
+        glamor_readback_destroy(glamor_priv,
+                                glamor_get_pixmap_private(victim->pixmap));
+    }
+
+    readback = calloc(1, sizeof (*readback));
+    if (!readback)
+        return NULL;
+
+    readback->bits = malloc(size);
+    if (!readback->bits) {
+        free(readback);
+        return NULL;
+    }
+
+    readback->pixmap = pixmap;
+    readback->stride = stride;
+    readback->size = size;
+    readback->serial = priv->serial;
+    RegionNull(&readback->valid);
+    xorg_list_append(&readback->link, &glamor_priv->readback_list);
+    glamor_priv->readback_size += size;
+    priv->readback = readback;
+    return readback;
+}
+
+/*
+ * Only pixmaps glamor alone draws to can be cached; clients render
+ * to exported ones behind our back. That includes the screen pixmap,
+ * exported as the DRI2 front buffer and for scanout.
+ */
+static Bool
+glamor_readback_allowed(glamor_screen_private *glamor_priv,
+                        PixmapPtr pixmap, glamor_pixmap_private *priv)
+{
+    if (!glamor_priv->readback_max || pixmap->drawable.bitsPerPixel < 8)
+        return FALSE;
+
+    return priv->type == GLAMOR_TEXTURE_ONLY;
+}
+
+/*
+ * Idle task: free the oldest cache that is out of date, and would only
+ * be thrown away on its next use.
+ */
+Bool
+glamor_readback_trim(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_pixmap_private *priv;
+    glamor_readback *readback;
+
+    xorg_list_for_each_entry(readback, &glamor_priv->readback_list, link) {
+        priv = glamor_get_pixmap_private(readback->pixmap);
+        if (readback->serial != priv->serial) {
+            glamor_readback_destroy(glamor_priv, priv);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*
+ * Read 'box' of the pixmap, in pixmap coordinates, into bits with the
+ * box origin at the start of bits. Returns FALSE when the cache isn't
+ * used for this pixmap, leaving the caller to read back directly.
+ */
+Bool
+glamor_readback_get(PixmapPtr pixmap, const BoxRec *box,
+                    uint8_t *bits, uint32_t byte_stride)
+{
+    glamor_screen_private *glamor_priv =
+        glamor_get_screen_private(pixmap->drawable.pScreen);
+    glamor_pixmap_private *priv = glamor_get_pixmap_private(pixmap);
+    glamor_readback *readback = priv->readback;
+    int cpp = pixmap->drawable.bitsPerPixel >> 3;
+    BoxRec clipped;
+    RegionRec need;
+    uint8_t *src;
+    int y;
+
+    if (!glamor_readback_allowed(glamor_priv, pixmap, priv))
+        return FALSE;
+
+    clipped.x1 = MAX(box->x1, 0);
+    clipped.y1 = MAX(box->y1, 0);
+    clipped.x2 = MIN(box->x2, pixmap->drawable.width);
+    clipped.y2 = MIN(box->y2, pixmap->drawable.height);
+    if (clipped.x1 >= clipped.x2 || clipped.y1 >= clipped.y2)
+        return FALSE;
+
+    if (!readback) {
+        /* Don't bother with pixmaps only read once */
+        if (!priv->readback_seen) {
+            priv->readback_seen = TRUE;
+            return FALSE;
+        }
+        readback = glamor_readback_create(glamor_priv, pixmap, priv);
+        if (!readback)
+            return FALSE;
+    } else {
+        if (readback->serial != priv->serial) {
+            RegionEmpty(&readback->valid);
+            readback->serial = priv->serial;
+        }
+        xorg_list_del(&readback->link);
+        xorg_list_append(&readback->link, &glamor_priv->readback_list);
+    }
+
+    RegionInit(&need, &clipped, 1);
+    RegionSubtract(&need, &need, &readback->valid);
+    if (RegionNotEmpty(&need)) {
+        BoxPtr b = RegionRects(&need);
+        int n = RegionNumRects(&need);
+
+        glamor_download_boxes(pixmap, b, n, 0, 0, 0, 0,
+                              readback->bits, readback->stride);
+        while (n--) {
+            glamor_priv->readback_bytes_read +=
+                (uint64_t) (b->x2 - b->x1) * (b->y2 - b->y1) * cpp;
+            b++;
+        }
+        if (!RegionUnion(&readback->valid, &readback->valid, &need))
+            RegionEmpty(&readback->valid);
+        glamor_priv->readback_misses++;
+    } else
+        glamor_priv->readback_hits++;
+    RegionUninit(&need);
+
+    src = readback->bits + clipped.y1 * readback->stride + clipped.x1 * cpp;
+    bits += (clipped.y1 - box->y1) * byte_stride +
+        (clipped.x1 - box->x1) * cpp;
+    for (y = clipped.y1; y < clipped.y2; y++) {
+        memcpy(bits, src, (clipped.x2 - clipped.x1) * cpp);
+        bits += byte_stride;
+        src += readback->stride;
+    }
+    glamor_priv->readback_bytes_served +=
+        (uint64_t) (clipped.x2 - clipped.x1) * (clipped.y2 - clipped.y1) * cpp;
+
+    return TRUE;
+}
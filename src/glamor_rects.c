@@ -112,11 +112,13 @@ glamor_poly_fill_rect_gl(DrawablePtr drawable,
     glEnable(GL_SCISSOR_TEST);
 
     glamor_pixmap_loop(pixmap_priv, box_index) {
-        int nbox = RegionNumRects(gc->pCompositeClip);
-        BoxPtr box = RegionRects(gc->pCompositeClip);
+        int nbox;
+        BoxPtr box;
 
         glamor_set_destination_drawable(drawable, box_index, TRUE, FALSE,
                                         prog->matrix_uniform, &off_x, &off_y);
+        nbox = glamor_stencil_clip(drawable, gc->pCompositeClip,
+                                   off_x, off_y, nrect, &box);
 
         while (nbox--) {
             glScissor(box->x1 + off_x,
@@ -133,6 +135,7 @@ glamor_poly_fill_rect_gl(DrawablePtr drawable,
     }
 
     glDisable(GL_SCISSOR_TEST);
+    glamor_stencil_clip_done(drawable->pScreen);
     if (glamor_priv->glsl_version >= 130)
         glVertexAttribDivisor(GLAMOR_VERTEX_POS, 0);
     glDisableVertexAttribArray(GLAMOR_VERTEX_POS);
@@ -160,7 +163,23 @@ void
 glamor_poly_fill_rect(DrawablePtr drawable,
                       GCPtr gc, int nrect, xRectangle *prect)
 {
-    if (glamor_poly_fill_rect_gl(drawable, gc, nrect, prect))
+    glamor_dispatch dispatch;
+    glamor_verify verify;
+    uint64_t area = 0;
+    int i;
+
+    for (i = 0; i < nrect; i++)
+        area += (uint64_t) prect[i].width * prect[i].height;
+
+    glamor_verify_begin(drawable, NULL, 0, &verify);
+    if (glamor_dispatch_begin(&dispatch, GLAMOR_DISPATCH_FILL_RECT,
+                              drawable, NULL, area) &&
+        glamor_poly_fill_rect_gl(drawable, gc, nrect, prect) &&
+        !glamor_verify_check(&verify)) {
+        glamor_dispatch_end(&dispatch, TRUE);
         return;
+    }
     glamor_poly_fill_rect_bail(drawable, gc, nrect, prect);
+    glamor_dispatch_end(&dispatch, FALSE);
+    glamor_verify_end(&verify, "fill_rect");
 }
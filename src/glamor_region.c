@@ -0,0 +1,272 @@
+/*
+ * Copyright © 2014 Keith Packard
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include "glamor_priv.h"
+#include "glamor_transfer.h"
+#include "glamor_transform.h"
+
+/*
+ * Convert a GPU-resident bitmap into a region without reading back
+ * the bitmap itself.
+ *
+ * A single pass run-length encodes each row of the bitmap into a
+ * small RGBA texture, one row of output per row of input. Column
+ * zero holds the number of spans in the row and columns
+ * 1..GLAMOR_REGION_MAX_SPANS hold the x1/x2 pair for each span, both
+ * stored as 16-bit values split across two channels. Only that
+ * table is read back, and the region is built from it on the CPU,
+ * merging identical adjacent rows into a single band.
+ */
+
+#define GLAMOR_REGION_MAX_SPANS 8
+
+static Bool
+use_bitmap_region(PixmapPtr pixmap, GCPtr gc, glamor_program *prog, void *arg)
+{
+    PixmapPtr bitmap = arg;
+    glamor_pixmap_private *bitmap_priv = glamor_get_pixmap_private(bitmap);
+
+    glamor_bind_texture(glamor_get_screen_private(pixmap->drawable.pScreen),
+                        GL_TEXTURE0, bitmap_priv->fbo, FALSE);
+    return TRUE;
+}
+
+static const glamor_facet glamor_facet_bitmap_region = {
+    .name = "bitmap_region",
+    .version = 130,
+    .vs_vars = "attribute vec2 primitive;\n",
+    .vs_exec = GLAMOR_POS(gl_Position, primitive.xy),
+    .fs_vars = ("vec4 encode(int a, int b) {\n"
+                "       return vec4(float(a & 255), float(a >> 8),\n"
+                "                   float(b & 255), float(b >> 8)) / 255.0;\n"
+                "}\n"),
+    .fs_exec = ("       int col = int(gl_FragCoord.x);\n"
+                "       int row = int(gl_FragCoord.y);\n"
+                "       int width = textureSize(sampler, 0).x;\n"
+                "       int n = 0;\n"
+                "       int start = 0;\n"
+                "       int x1 = 0, x2 = 0;\n"
+                "       bool in_span = false;\n"
+                "       for (int x = 0; x < width; x++) {\n"
+                "               bool on = texelFetch(sampler, ivec2(x, row), 0).w != 0.0;\n"
+                "               if (on && !in_span) {\n"
+                "                       start = x;\n"
+                "                       in_span = true;\n"
+                "               } else if (!on && in_span) {\n"
+                "                       n++;\n"
+                "                       if (n == col) {\n"
+                "                               x1 = start;\n"
+                "                               x2 = x;\n"
+                "                       }\n"
+                "                       in_span = false;\n"
+                "               }\n"
+                "       }\n"
+                "       if (in_span) {\n"
+                "               n++;\n"
+                "               if (n == col) {\n"
+                "                       x1 = start;\n"
+                "                       x2 = width;\n"
+                "               }\n"
+                "       }\n"
+                "       if (col == 0)\n"
+                "               gl_FragColor = encode(n, 0);\n"
+                "       else\n"
+                "               gl_FragColor = encode(x1, x2);\n"),
+    .locations = glamor_program_location_fillsamp,
+    .use = use_bitmap_region,
+};
+
+/*
+ * Pull a 16-bit value out of a BGRA pixel written by encode() above
+ */
+static inline int
+glamor_region_decode_lo(const uint8_t *p)
+{
+    return p[2] | (p[1] << 8);
+}
+
+static inline int
+glamor_region_decode_hi(const uint8_t *p)
+{
+    return p[0] | (p[3] << 8);
+}
+
+/*
+ * Append the spans of one row to the box list, extending the previous
+ * band instead when the spans match it exactly.
+ */
+static Bool
+glamor_region_add_row(BoxPtr *boxes, int *nbox, int *size,
+                      int *band_start, int *band_n,
+                      const uint8_t *row, int nspan, int y)
+{
+    BoxPtr b;
+    int i;
+
+    if (nspan == *band_n && nspan) {
+        b = *boxes + *band_start;
+        for (i = 0; i < nspan; i++) {
+            const uint8_t *p = row + (i + 1) * 4;
+
+            if (b[i].x1 != glamor_region_decode_lo(p) ||
+                b[i].x2 != glamor_region_decode_hi(p))
+                break;
+        }
+        if (i == nspan && b[0].y2 == y) {
+            for (i = 0; i < nspan; i++)
+                b[i].y2 = y + 1;
+            return TRUE;
+        }
+    }
+
+    if (*nbox + nspan > *size) {
+        int new_size = MAX(*size * 2, *nbox + nspan);
+        BoxPtr new_boxes = reallocarray(*boxes, new_size, sizeof (BoxRec));
+
+        if (!new_boxes)
+            return FALSE;
+        *boxes = new_boxes;
+        *size = new_size;
+    }
+
+    *band_start = *nbox;
+    *band_n = nspan;
+
+    b = *boxes + *nbox;
+    for (i = 0; i < nspan; i++) {
+        const uint8_t *p = row + (i + 1) * 4;
+
+        b[i].x1 = glamor_region_decode_lo(p);
+        b[i].x2 = glamor_region_decode_hi(p);
+        b[i].y1 = y;
+        b[i].y2 = y + 1;
+    }
+    *nbox += nspan;
+    return TRUE;
+}
+
+RegionPtr
+glamor_bitmap_to_region_gl(PixmapPtr bitmap)
+{
+    ScreenPtr screen = bitmap->drawable.pScreen;
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_pixmap_private *bitmap_priv = glamor_get_pixmap_private(bitmap);
+    glamor_program *prog = &glamor_priv->bitmap_region_prog;
+    int width = GLAMOR_REGION_MAX_SPANS + 1;
+    int height = bitmap->drawable.height;
+    PixmapPtr spans = NULL;
+    uint8_t *table = NULL;
+    BoxPtr boxes = NULL;
+    int nbox = 0, size = 0;
+    int band_start = 0, band_n = 0;
+    RegionPtr region = NULL;
+    GLshort *v;
+    char *vbo_offset;
+    int y;
+
+    if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(bitmap_priv))
+        return NULL;
+
+    if (glamor_pixmap_priv_is_large(bitmap_priv))
+        return NULL;
+
+    /* Not worth it when the span table is as large as the bitmap */
+    if (bitmap->drawable.width <= width * 4)
+        return NULL;
+
+    glamor_make_current(glamor_priv);
+
+    if (prog->failed)
+        return NULL;
+
+    if (!prog->prog) {
+        if (!glamor_build_program(screen, prog, &glamor_facet_bitmap_region,
+                                  NULL, NULL, NULL))
+            return NULL;
+    }
+
+    spans = glamor_create_pixmap(screen, width, height, 32,
+                                 GLAMOR_CREATE_NO_LARGE);
+    if (!spans)
+        return NULL;
+
+    if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(glamor_get_pixmap_private(spans)))
+        goto bail;
+
+    if (!glamor_use_program(spans, NULL, prog, bitmap))
+        goto bail;
+
+    glamor_set_alu(screen, GXcopy);
+
+    v = glamor_get_vbo_space(screen, 8 * sizeof (GLshort), &vbo_offset);
+
+    glEnableVertexAttribArray(GLAMOR_VERTEX_POS);
+    glVertexAttribPointer(GLAMOR_VERTEX_POS, 2, GL_SHORT, GL_FALSE,
+                          2 * sizeof (GLshort), vbo_offset);
+
+    v[0] = 0;           v[1] = 0;
+    v[2] = 0;           v[3] = height;
+    v[4] = width;       v[5] = height;
+    v[6] = width;       v[7] = 0;
+
+    glamor_put_vbo_space(screen);
+
+    glamor_set_destination_drawable(&spans->drawable, 0, FALSE, FALSE,
+                                    prog->matrix_uniform, NULL, NULL);
+
+    glamor_glDrawArrays_GL_QUADS(glamor_priv, 1);
+    glDisableVertexAttribArray(GLAMOR_VERTEX_POS);
+
+    table = xallocarray(height, width * 4);
+    if (!table)
+        goto bail;
+
+    glamor_download_rect(spans, 0, 0, width, height, table);
+
+    for (y = 0; y < height; y++) {
+        const uint8_t *row = table + y * width * 4;
+        int nspan = glamor_region_decode_lo(row);
+
+        /* Too complex for the table; let fb handle it */
+        if (nspan > GLAMOR_REGION_MAX_SPANS)
+            goto bail;
+
+        if (!glamor_region_add_row(&boxes, &nbox, &size,
+                                   &band_start, &band_n, row, nspan, y))
+            goto bail;
+    }
+
+    region = RegionCreate(NULL, 1);
+    if (region) {
+        RegionUninit(region);
+        if (!RegionInitBoxes(region, boxes, nbox)) {
+            RegionDestroy(region);
+            region = NULL;
+        }
+    }
+
+bail:
+    free(boxes);
+    free(table);
+    glamor_destroy_pixmap(spans);
+    return region;
+}
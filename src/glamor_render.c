@@ -33,6 +33,7 @@
  */
 
 #include "glamor_priv.h"
+#include "glamor_transfer.h"
 
 #include "mipict.h"
 #include "fbpict.h"
@@ -197,6 +198,24 @@ glamor_create_composite_fs(struct shader_key *key)
         "	float undef;\n"
         "	return vec4(color.a, undef, undef, undef);"
         "}";
+    /* 4x4 ordered dither, scaled to one step of a 565 channel */
+    const char *dest_swizzle_dither_565 =
+        "vec4 dest_swizzle(vec4 color)\n"
+        "{\n"
+        "	vec2 p = mod(floor(gl_FragCoord.xy), 4.0);\n"
+        "	vec2 a = mod(p, 2.0);\n"
+        "	vec2 b = floor(p / 2.0);\n"
+        "	float t = 4.0 * (2.0 * a.x + 3.0 * a.y - 4.0 * a.x * a.y) +\n"
+        "		  (2.0 * b.x + 3.0 * b.y - 4.0 * b.x * b.y);\n"
+        "	t = (t + 0.5) / 16.0 - 0.5;\n"
+        "	color.rgb += t * vec3(1.0 / 31.0, 1.0 / 63.0, 1.0 / 31.0);\n"
+        "	return clamp(color, 0.0, 1.0);\n"
+        "}\n";
+    const char *dest_swizzle_swap_rb =
+        "vec4 dest_swizzle(vec4 color)\n"
+        "{\n"
+        "	return color.bgra;\n"
+        "}\n";
 
     const char *in_normal =
         "void main()\n"
@@ -275,6 +294,12 @@ glamor_create_composite_fs(struct shader_key *key)
     case SHADER_DEST_SWIZZLE_ALPHA_TO_RED:
         dest_swizzle = dest_swizzle_alpha_to_red;
         break;
+    case SHADER_DEST_SWIZZLE_DITHER_565:
+        dest_swizzle = dest_swizzle_dither_565;
+        break;
+    case SHADER_DEST_SWIZZLE_SWAP_RB:
+        dest_swizzle = dest_swizzle_swap_rb;
+        break;
     default:
         FatalError("Bad composite shader dest swizzle");
     }
@@ -508,6 +533,170 @@ glamor_set_composite_op(ScreenPtr screen,
     return TRUE;
 }
 
+/* Use mip levels once a source is shrunk by more than this */
+#define GLAMOR_MIPMAP_MIN_DOWNSCALE     2.0
+
+/*
+ * Decide whether the bound texture of a filtered, transformed source
+ * should be sampled through its mip levels, (re)generating them when
+ * the pixmap contents changed since they were built. Mip storage
+ * counts against glamor_priv->mipmap_budget.
+ */
+static Bool
+glamor_composite_use_mipmap(glamor_screen_private *glamor_priv,
+                            PicturePtr picture,
+                            glamor_pixmap_private *pixmap_priv)
+{
+    glamor_pixmap_fbo *fbo = pixmap_priv->fbo;
+    PictTransform *t = picture->transform;
+    double a, b, sx, sy;
+    size_t size;
+
+    if (!glamor_priv->mipmap_budget || !t)
+        return FALSE;
+
+    if (glamor_pixmap_priv_is_large(pixmap_priv))
+        return FALSE;
+
+    /* Only affine transforms have a single scale factor */
+    if (t->matrix[2][0] || t->matrix[2][1] ||
+        t->matrix[2][2] != pixman_fixed_1)
+        return FALSE;
+
+    /* Squared length of the source step per destination pixel */
+    a = pixman_fixed_to_double(t->matrix[0][0]);
+    b = pixman_fixed_to_double(t->matrix[1][0]);
+    sx = a * a + b * b;
+    a = pixman_fixed_to_double(t->matrix[0][1]);
+    b = pixman_fixed_to_double(t->matrix[1][1]);
+    sy = a * a + b * b;
+    if (MAX(sx, sy) < GLAMOR_MIPMAP_MIN_DOWNSCALE * GLAMOR_MIPMAP_MIN_DOWNSCALE)
+        return FALSE;
+
+    if (fbo->mip_size && pixmap_priv->mip_serial == pixmap_priv->serial) {
+        glamor_priv->mipmap_hits++;
+        return TRUE;
+    }
+
+    /* The full chain adds a third of the base level */
+    size = (size_t) fbo->width * fbo->height *
+        (fbo->format == glamor_priv->one_channel_format ? 1 :
+         fbo->format == GL_RGB ? 2 : 4) / 3;
+
+    if (!fbo->mip_size &&
+        glamor_priv->mipmap_size + size > glamor_priv->mipmap_budget) {
+        glamor_priv->mipmap_over_budget++;
+        return FALSE;
+    }
+
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    if (!fbo->mip_size) {
+        fbo->mip_size = size;
+        glamor_priv->mipmap_size += size;
+    }
+    if (!pixmap_priv->mip_listed) {
+        xorg_list_add(&pixmap_priv->mip_link, &glamor_priv->mip_pixmaps);
+        pixmap_priv->mip_listed = TRUE;
+    }
+    pixmap_priv->mip_serial = pixmap_priv->serial;
+    glamor_priv->mipmap_generations++;
+    return TRUE;
+}
+
+/*
+ * Put the plain linear filter back on a source that may have been
+ * sampled through its mip levels. Other paths binding the texture
+ * don't set the filter, and would sample levels gone stale since.
+ */
+static void
+glamor_composite_unset_mipmap(int unit, PicturePtr picture, PixmapPtr pixmap)
+{
+    glamor_pixmap_private *pixmap_priv = glamor_get_pixmap_private(pixmap);
+
+    if (!pixmap_priv->fbo || !pixmap_priv->fbo->mip_size)
+        return;
+
+    switch (picture->filter) {
+    case PictFilterGood:
+    case PictFilterBest:
+    case PictFilterBilinear:
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        break;
+    }
+}
+
+/*
+ * Idle task: bring the mip levels of one pixmap drawn to since they
+ * were generated up to date, so the next scaled composite from it
+ * doesn't have to. Pixmaps whose FBO lost its mip levels are dropped
+ * from the list; glamor_composite_use_mipmap() adds them back.
+ */
+Bool
+glamor_composite_refresh_mipmaps(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_pixmap_private *priv, *tmp;
+
+    xorg_list_for_each_entry_safe(priv, tmp, &glamor_priv->mip_pixmaps,
+                                  mip_link) {
+        if (!priv->fbo || !priv->fbo->mip_size) {
+            xorg_list_del(&priv->mip_link);
+            priv->mip_listed = FALSE;
+            continue;
+        }
+        if (priv->mip_serial == priv->serial)
+            continue;
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, priv->fbo->tex);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        priv->mip_serial = priv->serial;
+        glamor_priv->mipmap_generations++;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/* Composite shaders nearly every session ends up needing */
+static const struct shader_key glamor_warm_shader_keys[] = {
+    { SHADER_SOURCE_TEXTURE, SHADER_MASK_NONE,
+      glamor_program_alpha_normal, SHADER_DEST_SWIZZLE_DEFAULT },
+    { SHADER_SOURCE_SOLID, SHADER_MASK_NONE,
+      glamor_program_alpha_normal, SHADER_DEST_SWIZZLE_DEFAULT },
+    { SHADER_SOURCE_SOLID, SHADER_MASK_TEXTURE_ALPHA,
+      glamor_program_alpha_normal, SHADER_DEST_SWIZZLE_DEFAULT },
+    { SHADER_SOURCE_TEXTURE, SHADER_MASK_TEXTURE_ALPHA,
+      glamor_program_alpha_normal, SHADER_DEST_SWIZZLE_DEFAULT },
+    { SHADER_SOURCE_TEXTURE_ALPHA, SHADER_MASK_NONE,
+      glamor_program_alpha_normal, SHADER_DEST_SWIZZLE_DEFAULT },
+    { SHADER_SOURCE_TEXTURE, SHADER_MASK_NONE,
+      glamor_program_alpha_normal, SHADER_DEST_SWIZZLE_ALPHA_TO_RED },
+};
+
+/*
+ * Idle task: compile one of the common composite shaders ahead of its
+ * first use, instead of stalling the request that needs it.
+ */
+Bool
+glamor_composite_warm_shaders(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    struct shader_key key;
+
+    if (glamor_priv->composite_warm_next >= ARRAY_SIZE(glamor_warm_shader_keys))
+        return FALSE;
+
+    key = glamor_warm_shader_keys[glamor_priv->composite_warm_next++];
+    if (key.dest_swizzle == SHADER_DEST_SWIZZLE_ALPHA_TO_RED &&
+        glamor_priv->one_channel_format != GL_RED)
+        return TRUE;
+
+    glamor_lookup_composite_shader(screen, &key);
+    return TRUE;
+}
+
 static void
 glamor_set_composite_texture(glamor_screen_private *glamor_priv, int unit,
                              PicturePtr picture,
@@ -530,6 +719,12 @@ glamor_set_composite_texture(glamor_screen_private *glamor_priv, int unit,
      */
     glamor_bind_texture(glamor_priv, GL_TEXTURE0 + unit, fbo,
                         glamor_fbo_red_is_alpha(glamor_priv, dest_priv->fbo));
+
+    /* Uploaded pictures were already swizzled into RGBA order */
+    if (PICT_FORMAT_TYPE(picture->format) == PICT_TYPE_ABGR &&
+        pixmap_priv->type != GLAMOR_MEMORY)
+        glamor_set_texture_swap_rb(fbo, TRUE);
+
     repeat_type = picture->repeatType;
     switch (picture->repeatType) {
     case RepeatNone:
@@ -568,7 +763,11 @@ glamor_set_composite_texture(glamor_screen_private *glamor_priv, int unit,
     case PictFilterGood:
     case PictFilterBest:
     case PictFilterBilinear:
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        if (glamor_composite_use_mipmap(glamor_priv, picture, pixmap_priv))
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                            GL_LINEAR_MIPMAP_LINEAR);
+        else
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         break;
     }
@@ -775,7 +974,14 @@ glamor_set_normalize_tcoords_generic(PixmapPtr pixmap,
  * We could support many more formats by using GL_ARB_texture_view to
  * parse the same bits as different formats.  For now, we only support
  * tweaking whether we sample the alpha bits of an a8r8g8b8, or just
- * force them to 1.
+ * force them to 1.  r5g6b5 has no alpha, so it samples and renders
+ * the same whether the pixmap is in an RGB565 or an RGBA texture.
+ *
+ * The ABGR formats hold the same channels as their ARGB counterparts
+ * with red and blue exchanged; they are swapped back on the way out
+ * of the shader, and by the texture swizzle when sampled. The 10 bit
+ * formats only exist on depth 30 pixmaps, which are only given FBOs
+ * when RGB10_A2 textures work.
  */
 static Bool
 glamor_render_format_is_supported(PictFormatShort format)
@@ -783,6 +989,13 @@ glamor_render_format_is_supported(PictFormatShort format)
     switch (format) {
     case PICT_a8r8g8b8:
     case PICT_x8r8g8b8:
+    case PICT_a8b8g8r8:
+    case PICT_x8b8g8r8:
+#if XORG_VERSION_CURRENT >= 10699900
+    case PICT_x2r10g10b10:
+    case PICT_x2b10g10r10:
+#endif
+    case PICT_r5g6b5:
     case PICT_a8:
         return TRUE;
     default:
@@ -790,6 +1003,109 @@ glamor_render_format_is_supported(PictFormatShort format)
     }
 }
 
+/*
+ * a1 pictures with an FBO are GPU bitmaps, stored a byte per pixel as
+ * 0x00 or 0xff, so they sample exactly like a8. They aren't supported
+ * as destinations, where results would need rounding to one bit.
+ */
+static Bool
+glamor_render_source_format_is_supported(glamor_screen_private *glamor_priv,
+                                         PictFormatShort format)
+{
+    if (format == PICT_a1)
+        return TRUE;
+
+    if (PICT_FORMAT_TYPE(format) == PICT_TYPE_ABGR &&
+        !glamor_priv->has_texture_swizzle)
+        return FALSE;
+
+    return glamor_render_format_is_supported(format);
+}
+
+/*
+ * A repeating 1x1 picture samples the same value everywhere, so it
+ * can be treated as a solid color. That saves binding and sampling a
+ * texture, and lets those composites share the solid programs. The
+ * pixel comes from the CPU copy when there is one; otherwise it is
+ * read back once and cached until the pixmap contents change.
+ */
+static Bool
+glamor_composite_solid_picture(PicturePtr picture, PixmapPtr pixmap,
+                               GLfloat *color)
+{
+    glamor_pixmap_private *priv;
+    CARD32 pixel;
+
+    if (!picture->pDrawable || picture->pDrawable->type != DRAWABLE_PIXMAP)
+        return FALSE;
+
+    if (picture->pDrawable->width != 1 || picture->pDrawable->height != 1 ||
+        !picture->repeat || picture->alphaMap)
+        return FALSE;
+
+    priv = glamor_get_pixmap_private(pixmap);
+
+    if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(priv)) {
+        if (!pixmap->devPrivate.ptr)
+            return FALSE;
+
+        switch (pixmap->drawable.bitsPerPixel) {
+        case 8:
+            pixel = *(CARD8 *) pixmap->devPrivate.ptr;
+            break;
+        case 16:
+            pixel = *(CARD16 *) pixmap->devPrivate.ptr;
+            break;
+        case 32:
+            pixel = *(CARD32 *) pixmap->devPrivate.ptr;
+            break;
+        default:
+            return FALSE;
+        }
+    } else {
+        /* Other clients may render to shared pixmaps behind our back */
+        if (priv->type != GLAMOR_TEXTURE_ONLY)
+            return FALSE;
+
+        if (priv->solid_serial != priv->serial || priv->serial == 0) {
+            CARD32 bits[1];
+
+            switch (pixmap->drawable.depth) {
+            case 8:
+            case 15:
+            case 16:
+            case 24:
+            case 32:
+                break;
+            default:
+                return FALSE;
+            }
+
+            bits[0] = 0;
+            glamor_download_rect(pixmap, 0, 0, 1, 1, (uint8_t *) bits);
+
+            switch (pixmap->drawable.bitsPerPixel) {
+            case 8:
+                priv->solid_pixel = *(CARD8 *) bits;
+                break;
+            case 16:
+                priv->solid_pixel = *(CARD16 *) bits;
+                break;
+            default:
+                priv->solid_pixel = bits[0];
+                break;
+            }
+            priv->solid_serial = priv->serial;
+        }
+        pixel = priv->solid_pixel;
+    }
+
+    return glamor_get_rgba_from_pixel(pixel,
+                                      &color[0], &color[1],
+                                      &color[2], &color[3],
+                                      picture->format);
+}
+
 static Bool
 glamor_composite_choose_shader(CARD8 op,
                                PicturePtr source,
@@ -847,6 +1163,10 @@ glamor_composite_choose_shader(CARD8 op,
         else
             goto fail;
     }
+    else if (glamor_composite_solid_picture(source, source_pixmap,
+                                            source_solid_color)) {
+        key.source = SHADER_SOURCE_SOLID;
+    }
     else {
         if (PICT_FORMAT_A(source->format))
             key.source = SHADER_SOURCE_TEXTURE_ALPHA;
@@ -867,6 +1187,10 @@ glamor_composite_choose_shader(CARD8 op,
             else
                 goto fail;
         }
+        else if (glamor_composite_solid_picture(mask, mask_pixmap,
+                                                mask_solid_color)) {
+            key.mask = SHADER_MASK_SOLID;
+        }
         else {
             if (PICT_FORMAT_A(mask->format))
                 key.mask = SHADER_MASK_TEXTURE_ALPHA;
@@ -902,6 +1226,12 @@ glamor_composite_choose_shader(CARD8 op,
     if (dest_pixmap->drawable.bitsPerPixel <= 8 &&
         glamor_priv->one_channel_format == GL_RED) {
         key.dest_swizzle = SHADER_DEST_SWIZZLE_ALPHA_TO_RED;
+    } else if (glamor_priv->dither && dest->format == PICT_r5g6b5 &&
+               key.in == glamor_program_alpha_normal) {
+        /* Only where the output is a color, not a blend factor */
+        key.dest_swizzle = SHADER_DEST_SWIZZLE_DITHER_565;
+    } else if (PICT_FORMAT_TYPE(dest->format) == PICT_TYPE_ABGR) {
+        key.dest_swizzle = SHADER_DEST_SWIZZLE_SWAP_RB;
     } else {
         key.dest_swizzle = SHADER_DEST_SWIZZLE_DEFAULT;
     }
@@ -999,8 +1329,9 @@ glamor_composite_choose_shader(CARD8 op,
                 glamor_fallback("Failed to upload source texture.\n");
                 goto fail;
             }
-        } else {
-            if (!glamor_render_format_is_supported(source->format)) {
+        } else if (key.source != SHADER_SOURCE_SOLID) {
+            if (!glamor_render_source_format_is_supported(glamor_priv,
+                                                          source->format)) {
                 glamor_fallback("Unsupported source picture format.\n");
                 goto fail;
             }
@@ -1011,8 +1342,9 @@ glamor_composite_choose_shader(CARD8 op,
                 glamor_fallback("Failed to upload mask texture.\n");
                 goto fail;
             }
-        } else if (mask) {
-            if (!glamor_render_format_is_supported(mask->format)) {
+        } else if (mask && key.mask != SHADER_MASK_SOLID) {
+            if (!glamor_render_source_format_is_supported(glamor_priv,
+                                                          mask->format)) {
                 glamor_fallback("Unsupported mask picture format.\n");
                 goto fail;
             }
@@ -1170,6 +1502,9 @@ glamor_composite_with_shader(CARD8 op,
 
     glamor_make_current(glamor_priv);
 
+    if (!glamor_pixmap_unshare(dest_pixmap))
+        goto fail;
+
     glamor_set_destination_pixmap_priv_nc(glamor_priv, dest_pixmap, dest_pixmap_priv);
     glamor_composite_set_shader_blend(glamor_priv, dest_pixmap_priv, &key, shader, &op_info);
     glamor_set_alu(screen, GXcopy);
@@ -1291,6 +1626,10 @@ glamor_composite_with_shader(CARD8 op,
     glDisableVertexAttribArray(GLAMOR_VERTEX_SOURCE);
     glDisableVertexAttribArray(GLAMOR_VERTEX_MASK);
     glDisable(GL_BLEND);
+    if (key.source != SHADER_SOURCE_SOLID)
+        glamor_composite_unset_mipmap(0, source, source_pixmap);
+    if (key.mask != SHADER_MASK_NONE && key.mask != SHADER_MASK_SOLID)
+        glamor_composite_unset_mipmap(1, mask, mask_pixmap);
     DEBUGF("finish rendering.\n");
     if (saved_source_format)
         source->format = saved_source_format;
@@ -1578,6 +1917,146 @@ glamor_composite_clipped_region(CARD8 op,
     return ok;
 }
 
+/*
+ * Most picture transforms seen in practice are nothing of the sort:
+ * toolkits and compositors set identity matrices, integer offsets,
+ * pixel doubling scales and quarter turns. Handing all of them to the
+ * general transform path costs the copy fast path, forces GLES2 onto
+ * the RepeatFix shader and makes large pixmaps go through the
+ * transformed-region machinery. Classify each transform so the GL
+ * paths only see what actually needs a matrix.
+ *
+ * The class is computed per call rather than cached with the
+ * picture, as SetPictureTransform rewrites the matrix in place.
+ */
+typedef enum {
+    GLAMOR_TRANSFORM_IDENTITY,
+    GLAMOR_TRANSFORM_TRANSLATE,     /* integer translation only */
+    GLAMOR_TRANSFORM_AFFINE,        /* includes scales and rotations */
+    GLAMOR_TRANSFORM_PROJECTIVE,
+} glamor_transform_class;
+
+typedef struct {
+    PicturePtr picture;
+    PictTransform *transform;
+    unsigned int repeat;
+    unsigned int repeat_type;
+    INT16 x, y;
+} glamor_transform_saved;
+
+static glamor_transform_class
+glamor_classify_transform(const PictTransform *t)
+{
+    if (!t)
+        return GLAMOR_TRANSFORM_IDENTITY;
+
+    if (t->matrix[2][0] || t->matrix[2][1] ||
+        t->matrix[2][2] != pixman_fixed_1)
+        return GLAMOR_TRANSFORM_PROJECTIVE;
+
+    if (t->matrix[0][0] != pixman_fixed_1 || t->matrix[0][1] ||
+        t->matrix[1][0] || t->matrix[1][1] != pixman_fixed_1)
+        return GLAMOR_TRANSFORM_AFFINE;
+
+    if (pixman_fixed_frac(t->matrix[0][2]) ||
+        pixman_fixed_frac(t->matrix[1][2]))
+        return GLAMOR_TRANSFORM_AFFINE;
+
+    if (!t->matrix[0][2] && !t->matrix[1][2])
+        return GLAMOR_TRANSFORM_IDENTITY;
+
+    return GLAMOR_TRANSFORM_TRANSLATE;
+}
+
+/*
+ * Rewrite a source or mask picture for the GL paths according to its
+ * transform class. 'extents' is the composite region in destination
+ * screen coordinates and dx/dy move it into picture coordinates.
+ * Undone again by glamor_transform_restore().
+ */
+static void
+glamor_transform_simplify(glamor_screen_private *glamor_priv,
+                          PicturePtr picture, const BoxRec *extents,
+                          int dx, int dy, INT16 *x, INT16 *y,
+                          glamor_transform_saved *saved)
+{
+    PixmapPtr pixmap;
+    PictTransform *t;
+    BoxRec box;
+    int tx, ty;
+
+    saved->picture = NULL;
+    if (!picture || !picture->pDrawable || !picture->transform)
+        return;
+
+    t = picture->transform;
+    saved->picture = picture;
+    saved->transform = t;
+    saved->repeat = picture->repeat;
+    saved->repeat_type = picture->repeatType;
+    saved->x = *x;
+    saved->y = *y;
+
+    switch (glamor_classify_transform(t)) {
+    case GLAMOR_TRANSFORM_IDENTITY:
+        picture->transform = NULL;
+        break;
+    case GLAMOR_TRANSFORM_TRANSLATE:
+        tx = *x + pixman_fixed_to_int(t->matrix[0][2]);
+        ty = *y + pixman_fixed_to_int(t->matrix[1][2]);
+        if (tx != (INT16) tx || ty != (INT16) ty)
+            break;
+        *x = tx;
+        *y = ty;
+        picture->transform = NULL;
+        break;
+    case GLAMOR_TRANSFORM_AFFINE:
+        /* GLES2 has no clamp to border, so a transformed RepeatNone
+         * source gets the RepeatFix shader. With nearest sampling
+         * that lands entirely inside the source, clamping to the edge
+         * gives the same result.
+         */
+        if (glamor_priv->gl_flavor != GLAMOR_GL_ES2 ||
+            picture->repeatType != RepeatNone ||
+            (picture->filter != PictFilterNearest &&
+             picture->filter != PictFilterFast))
+            break;
+        pixmap = glamor_get_drawable_pixmap(picture->pDrawable);
+        if (glamor_pixmap_is_large(pixmap))
+            break;
+        box.x1 = extents->x1 + dx;
+        box.y1 = extents->y1 + dy;
+        box.x2 = extents->x2 + dx;
+        box.y2 = extents->y2 + dy;
+        if (!pixman_transform_bounds(t, &box))
+            break;
+        if (box.x1 < 0 || box.y1 < 0 ||
+            box.x2 > picture->pDrawable->width ||
+            box.y2 > picture->pDrawable->height)
+            break;
+        picture->repeat = 1;
+        picture->repeatType = RepeatPad;
+        break;
+    case GLAMOR_TRANSFORM_PROJECTIVE:
+        break;
+    }
+}
+
+static void
+glamor_transform_restore(glamor_transform_saved *saved, INT16 *x, INT16 *y)
+{
+    PicturePtr picture = saved->picture;
+
+    if (!picture)
+        return;
+
+    picture->transform = saved->transform;
+    picture->repeat = saved->repeat;
+    picture->repeatType = saved->repeat_type;
+    *x = saved->x;
+    *y = saved->y;
+}
+
 void
 glamor_composite(CARD8 op,
                  PicturePtr source,
@@ -1595,9 +2074,15 @@ glamor_composite(CARD8 op,
     glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
     RegionRec region;
     BoxPtr extent;
+    BoxRec dest_box;
+    glamor_verify verify = { 0 };
+    glamor_dispatch dispatch = { 0 };
+    glamor_transform_saved source_saved = { 0 }, mask_saved = { 0 };
     int nbox, ok = FALSE;
     int force_clip = 0;
 
+    glamor_trace_begin(GLAMOR_TRACE_COMPOSITE, width, height);
+
     if (source->pDrawable) {
         source_pixmap = glamor_get_drawable_pixmap(source->pDrawable);
         if (glamor_pixmap_drm_only(source_pixmap))
@@ -1650,6 +2135,7 @@ glamor_composite(CARD8 op,
                                   (mask_pixmap ? mask->pDrawable->y : 0),
                                   x_dest + dest->pDrawable->x,
                                   y_dest + dest->pDrawable->y, width, height)) {
+        glamor_trace_end(GLAMOR_TRACE_COMPOSITE);
         return;
     }
 
@@ -1657,8 +2143,10 @@ glamor_composite(CARD8 op,
     DEBUGF("first clipped when compositing.\n");
     DEBUGRegionPrint(&region);
     extent = RegionExtents(&region);
-    if (nbox == 0)
+    if (nbox == 0) {
+        glamor_trace_end(GLAMOR_TRACE_COMPOSITE);
         return;
+    }
 
     /* If destination is not a large pixmap, but the region is larger
      * than texture size limitation, and source or mask is memory pixmap,
@@ -1681,6 +2169,33 @@ glamor_composite(CARD8 op,
                 mask->pSourcePict->type != SourcePictTypeSolidFill)))
         force_clip = 1;
 
+    dest_box.x1 = dest->pDrawable->x + x_dest;
+    dest_box.y1 = dest->pDrawable->y + y_dest;
+    dest_box.x2 = dest_box.x1 + width;
+    dest_box.y2 = dest_box.y1 + height;
+
+    if (!glamor_dispatch_begin(&dispatch, GLAMOR_DISPATCH_COMPOSITE,
+                               dest->pDrawable,
+                               source_pixmap ? source->pDrawable : NULL,
+                               (uint64_t) width * height)) {
+        REGION_UNINIT(dest->pDrawable->pScreen, &region);
+        goto fail;
+    }
+
+    glamor_verify_begin(dest->pDrawable, &dest_box, 1, &verify);
+
+    /* A picture used as both source and mask is left alone, as its
+     * offsets can only be folded one way */
+    if (source != mask) {
+        glamor_transform_simplify(glamor_priv, source, extent,
+                                  x_source - dest_box.x1,
+                                  y_source - dest_box.y1,
+                                  &x_source, &y_source, &source_saved);
+        glamor_transform_simplify(glamor_priv, mask, extent,
+                                  x_mask - dest_box.x1, y_mask - dest_box.y1,
+                                  &x_mask, &y_mask, &mask_saved);
+    }
+
     if (force_clip || glamor_pixmap_is_large(dest_pixmap)
         || (source_pixmap
             && glamor_pixmap_is_large(source_pixmap))
@@ -1704,10 +2219,17 @@ glamor_composite(CARD8 op,
                                              x_source, y_source,
                                              x_mask, y_mask, x_dest, y_dest);
 
+    /* The fb fallback below wants the pictures as the client set them */
+    glamor_transform_restore(&mask_saved, &x_mask, &y_mask);
+    glamor_transform_restore(&source_saved, &x_source, &y_source);
+
     REGION_UNINIT(dest->pDrawable->pScreen, &region);
 
-    if (ok)
+    if (ok && !glamor_verify_check(&verify)) {
+        glamor_dispatch_end(&dispatch, TRUE);
+        glamor_trace_end(GLAMOR_TRACE_COMPOSITE);
         return;
+    }
 
  fail:
 
@@ -1725,6 +2247,11 @@ glamor_composite(CARD8 op,
          dest->pDrawable->width, dest->pDrawable->height,
          glamor_get_picture_location(dest));
 
+    /* Keep what gets read back for the next fallback */
+    glamor_prefetch_picture(dest);
+    glamor_prefetch_picture(source);
+    glamor_prefetch_picture(mask);
+
     if (glamor_prepare_access_picture_box(dest, GLAMOR_ACCESS_RW,
                                           x_dest, y_dest, width, height) &&
         glamor_prepare_access_picture_box(source, GLAMOR_ACCESS_RO,
@@ -1740,4 +2267,8 @@ glamor_composite(CARD8 op,
     glamor_finish_access_picture(mask);
     glamor_finish_access_picture(source);
     glamor_finish_access_picture(dest);
+
+    glamor_dispatch_end(&dispatch, FALSE);
+    glamor_verify_end(&verify, "composite");
+    glamor_trace_end(GLAMOR_TRACE_COMPOSITE);
 }
@@ -120,11 +120,13 @@ glamor_fill_spans_gl(DrawablePtr drawable,
     glEnable(GL_SCISSOR_TEST);
 
     glamor_pixmap_loop(pixmap_priv, box_index) {
-        int nbox = RegionNumRects(gc->pCompositeClip);
-        BoxPtr box = RegionRects(gc->pCompositeClip);
+        int nbox;
+        BoxPtr box;
 
         glamor_set_destination_drawable(drawable, box_index, FALSE, FALSE,
                                         prog->matrix_uniform, &off_x, &off_y);
+        nbox = glamor_stencil_clip(drawable, gc->pCompositeClip,
+                                   off_x, off_y, n, &box);
 
         while (nbox--) {
             glScissor(box->x1 + off_x,
@@ -141,6 +143,7 @@ glamor_fill_spans_gl(DrawablePtr drawable,
     }
 
     glDisable(GL_SCISSOR_TEST);
+    glamor_stencil_clip_done(drawable->pScreen);
     if (glamor_priv->glsl_version >= 130)
         glVertexAttribDivisor(GLAMOR_VERTEX_POS, 0);
     glDisableVertexAttribArray(GLAMOR_VERTEX_POS);
@@ -272,6 +275,7 @@ glamor_set_spans_gl(DrawablePtr drawable, GCPtr gc, char *src,
     GLenum type;
     GLenum format;
     int off_x, off_y;
+    BoxRec damage;
 
     pixmap_priv = glamor_get_pixmap_private(pixmap);
     if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(pixmap_priv))
@@ -283,10 +287,20 @@ glamor_set_spans_gl(DrawablePtr drawable, GCPtr gc, char *src,
     if (!glamor_pm_is_solid(gc->depth, gc->planemask))
         goto bail;
 
+    if (!glamor_pixmap_unshare(pixmap))
+        goto bail;
+
     glamor_get_drawable_deltas(drawable, pixmap, &off_x, &off_y);
     glamor_format_for_pixmap(pixmap, &format, &type);
 
+    damage = *RegionExtents(gc->pCompositeClip);
+    damage.x1 += off_x;
+    damage.y1 += off_y;
+    damage.x2 += off_x;
+    damage.y2 += off_y;
+
     glamor_make_current(glamor_priv);
+    glamor_pixmap_begin_write(pixmap, pixmap_priv, &damage);
 
     glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
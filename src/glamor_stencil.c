@@ -0,0 +1,168 @@
+/*
+ * Copyright © 2014 Keith Packard
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include "glamor_priv.h"
+
+/*
+ * Clipping with the stencil buffer.
+ *
+ * The GC drawing paths clip by drawing everything once per clip box
+ * with the scissor set to that box. With long clip lists and lots of
+ * primitives, it's cheaper to write the clip list into a stencil
+ * buffer attached to the destination FBO and draw everything once
+ * under the stencil test. The stencil contents are kept with the FBO
+ * and only rewritten when a different clip list comes along.
+ *
+ * Callers replace their clip list with what glamor_stencil_clip()
+ * returns, and call glamor_stencil_clip_done() afterwards.
+ */
+
+/* Clip lists shorter than this are always handled with the scissor */
+#define GLAMOR_STENCIL_CLIP_MIN_BOXES   4
+
+/* Nor is it worth it until per-box drawing repeats this many
+ * primitives */
+#define GLAMOR_STENCIL_CLIP_MIN_WORK    256
+
+void
+glamor_stencil_init(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+
+    if (glamor_priv->gl_flavor == GLAMOR_GL_DESKTOP)
+        glamor_priv->stencil_format = GL_DEPTH24_STENCIL8;
+    else
+        glamor_priv->stencil_format = GL_STENCIL_INDEX8;
+
+    if (getenv("GLAMOR_NO_STENCIL_CLIP"))
+        glamor_priv->stencil_format = GL_NONE;
+}
+
+/*
+ * Release the stencil buffer of an FBO being destroyed
+ */
+void
+glamor_stencil_fini_fbo(glamor_pixmap_fbo *fbo)
+{
+    if (fbo->stencil)
+        glDeleteRenderbuffers(1, &fbo->stencil);
+    RegionUninit(&fbo->stencil_clip);
+}
+
+static Bool
+glamor_stencil_attach(glamor_screen_private *glamor_priv,
+                      glamor_pixmap_fbo *fbo)
+{
+    glGenRenderbuffers(1, &fbo->stencil);
+    glBindRenderbuffer(GL_RENDERBUFFER, fbo->stencil);
+    glRenderbufferStorage(GL_RENDERBUFFER, glamor_priv->stencil_format,
+                          fbo->width, fbo->height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT,
+                              GL_RENDERBUFFER, fbo->stencil);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE) {
+        /* Nothing has been written to it yet */
+        RegionNull(&fbo->stencil_clip);
+        return TRUE;
+    }
+
+    /* Don't try again on this or any other FBO */
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT,
+                              GL_RENDERBUFFER, 0);
+    glDeleteRenderbuffers(1, &fbo->stencil);
+    fbo->stencil = 0;
+    glamor_priv->stencil_format = GL_NONE;
+    LogMessageVerb(X_INFO, 3, "glamor: stencil clipping unavailable\n");
+    return FALSE;
+}
+
+/*
+ * Set up clipping to 'clip' for drawing nprim primitives to the
+ * destination just set with glamor_set_destination_drawable(), which
+ * returned off_x/off_y. Returns the number of boxes to draw with the
+ * scissor and sets *boxes: either the clip list itself, or just its
+ * extents when the stencil test does the rest.
+ */
+int
+glamor_stencil_clip(DrawablePtr drawable, RegionPtr clip,
+                    int off_x, int off_y, int nprim, BoxPtr *boxes)
+{
+    glamor_screen_private *glamor_priv =
+        glamor_get_screen_private(drawable->pScreen);
+    glamor_pixmap_private *pixmap_priv =
+        glamor_get_pixmap_private(glamor_get_drawable_pixmap(drawable));
+    glamor_pixmap_fbo *fbo = pixmap_priv->fbo;
+    int nbox = RegionNumRects(clip);
+    BoxPtr box;
+
+    *boxes = RegionRects(clip);
+
+    if (glamor_priv->stencil_format == GL_NONE ||
+        nbox < GLAMOR_STENCIL_CLIP_MIN_BOXES ||
+        (long) nbox * nprim < GLAMOR_STENCIL_CLIP_MIN_WORK ||
+        glamor_pixmap_priv_is_large(pixmap_priv) || !fbo->fb)
+        return nbox;
+
+    if (!fbo->stencil && !glamor_stencil_attach(glamor_priv, fbo))
+        return nbox;
+
+    if (off_x != fbo->stencil_x || off_y != fbo->stencil_y ||
+        !RegionEqual(&fbo->stencil_clip, clip)) {
+        glStencilMask(0xff);
+        glClearStencil(0);
+        glDisable(GL_SCISSOR_TEST);
+        glClear(GL_STENCIL_BUFFER_BIT);
+        glEnable(GL_SCISSOR_TEST);
+
+        glClearStencil(1);
+        for (box = RegionRects(clip); nbox--; box++) {
+            glScissor(box->x1 + off_x,
+                      box->y1 + off_y,
+                      box->x2 - box->x1,
+                      box->y2 - box->y1);
+            glClear(GL_STENCIL_BUFFER_BIT);
+        }
+
+        if (!RegionCopy(&fbo->stencil_clip, clip)) {
+            /* Make sure the next call redraws it */
+            RegionEmpty(&fbo->stencil_clip);
+        }
+        fbo->stencil_x = off_x;
+        fbo->stencil_y = off_y;
+        glamor_priv->stencil_clip_updates++;
+    }
+
+    glStencilFunc(GL_EQUAL, 1, 0xff);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+    glEnable(GL_STENCIL_TEST);
+    glamor_priv->stencil_clip_draws++;
+
+    *boxes = RegionExtents(clip);
+    return 1;
+}
+
+void
+glamor_stencil_clip_done(ScreenPtr screen)
+{
+    glDisable(GL_STENCIL_TEST);
+}
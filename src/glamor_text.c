@@ -189,12 +189,14 @@ glamor_text(DrawablePtr drawable, GCPtr gc,
         glEnable(GL_SCISSOR_TEST);
 
         glamor_pixmap_loop(pixmap_priv, box_index) {
-            BoxPtr box = RegionRects(gc->pCompositeClip);
-            int nbox = RegionNumRects(gc->pCompositeClip);
+            int nbox;
+            BoxPtr box;
 
             glamor_set_destination_drawable(drawable, box_index, TRUE, FALSE,
                                             prog->matrix_uniform,
                                             &off_x, &off_y);
+            nbox = glamor_stencil_clip(drawable, gc->pCompositeClip,
+                                       off_x, off_y, nglyph, &box);
 
             /* Run over the clip list, drawing the glyphs
              * in each box
@@ -210,6 +212,7 @@ glamor_text(DrawablePtr drawable, GCPtr gc,
             }
         }
         glDisable(GL_SCISSOR_TEST);
+        glamor_stencil_clip_done(drawable->pScreen);
     }
 
     glVertexAttribDivisor(GLAMOR_VERTEX_SOURCE, 0);
@@ -303,13 +306,57 @@ bail:
     return FALSE;
 }
 
+/*
+ * Software version of glamor_poly_text, only used as the reference
+ * for GLAMOR_VERIFY
+ */
+static void
+glamor_poly_text_bail(DrawablePtr drawable, GCPtr gc,
+                      int x, int y, int count, char *chars, Bool sixteen)
+{
+    CharInfoPtr charinfo[255];
+    unsigned long n;
+    FontEncoding encoding = Linear8Bit;
+
+    if (sixteen)
+        encoding = FONTLASTROW(gc->font) == 0 ? Linear16Bit : TwoD16Bit;
+
+    GetGlyphs(gc->font, count, (unsigned char *) chars, encoding,
+              &n, charinfo);
+
+    if (glamor_prepare_access(drawable, GLAMOR_ACCESS_RW) &&
+        glamor_prepare_access_gc(gc)) {
+        fbPolyGlyphBlt(drawable, gc, x, y, n, charinfo,
+                       FONTGLYPHS(gc->font));
+    }
+    glamor_finish_access_gc(gc);
+    glamor_finish_access(drawable);
+}
+
+static Bool
+glamor_poly_text_verify(DrawablePtr drawable, GCPtr gc,
+                        int x, int y, int count, char *chars, Bool sixteen,
+                        int *final_pos)
+{
+    glamor_verify verify;
+    Bool ok;
+
+    glamor_verify_begin(drawable, NULL, 0, &verify);
+    ok = glamor_poly_text(drawable, gc, x, y, count, chars, sixteen,
+                          final_pos);
+    if (ok && glamor_verify_check(&verify))
+        glamor_poly_text_bail(drawable, gc, x, y, count, chars, sixteen);
+    glamor_verify_end(&verify, "poly_text");
+    return ok;
+}
+
 int
 glamor_poly_text8(DrawablePtr drawable, GCPtr gc,
                    int x, int y, int count, char *chars)
 {
     int final_pos;
 
-    if (glamor_poly_text(drawable, gc, x, y, count, chars, FALSE, &final_pos))
+    if (glamor_poly_text_verify(drawable, gc, x, y, count, chars, FALSE, &final_pos))
         return final_pos;
     return miPolyText8(drawable, gc, x, y, count, chars);
 }
@@ -320,7 +367,7 @@ glamor_poly_text16(DrawablePtr drawable, GCPtr gc,
 {
     int final_pos;
 
-    if (glamor_poly_text(drawable, gc, x, y, count, (char *) chars, TRUE, &final_pos))
+    if (glamor_poly_text_verify(drawable, gc, x, y, count, (char *) chars, TRUE, &final_pos))
         return final_pos;
     return miPolyText16(drawable, gc, x, y, count, chars);
 }
@@ -0,0 +1,194 @@
+/*
+ * Copyright © 2014 Keith Packard
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include "glamor_priv.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+/*
+ * Worker threads for CPU-side pixel work.
+ *
+ * Jobs are split into horizontal stripes which the workers and the
+ * main thread pull from a shared counter; the caller returns once
+ * every stripe is done. Stripe functions must only touch their own
+ * rows and must not call back into the server, so they are limited
+ * to pixman and plain memory work.
+ *
+ * The pool is shared by all screens. GLAMOR_THREADS sets the number
+ * of workers; 0 keeps everything on the main thread.
+ */
+
+#define GLAMOR_THREADS_MAX              8
+
+/* Jobs smaller than this aren't worth waking anyone up for */
+#define GLAMOR_THREADS_MIN_BYTES        (256 * 1024)
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    pthread_t threads[GLAMOR_THREADS_MAX];
+    int nthreads;
+    int users;
+    Bool quit;
+
+    /* The job being run */
+    glamor_stripe_func func;
+    void *closure;
+    int height;
+    int next;
+    int nstripes;
+    int pending;
+} glamor_threads = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+/*
+ * Run stripes of the current job until there are none left. Called
+ * with the lock held; drops it while running each stripe.
+ */
+static void
+glamor_threads_run_locked(void)
+{
+    while (glamor_threads.next < glamor_threads.nstripes) {
+        int i = glamor_threads.next++;
+        int n = glamor_threads.nstripes;
+        int y1 = glamor_threads.height * i / n;
+        int y2 = glamor_threads.height * (i + 1) / n;
+        glamor_stripe_func func = glamor_threads.func;
+        void *closure = glamor_threads.closure;
+
+        pthread_mutex_unlock(&glamor_threads.lock);
+        func(closure, y1, y2);
+        pthread_mutex_lock(&glamor_threads.lock);
+
+        if (--glamor_threads.pending == 0)
+            pthread_cond_signal(&glamor_threads.done);
+    }
+}
+
+static void *
+glamor_threads_worker(void *arg)
+{
+    pthread_mutex_lock(&glamor_threads.lock);
+    for (;;) {
+        while (!glamor_threads.quit &&
+               glamor_threads.next >= glamor_threads.nstripes)
+            pthread_cond_wait(&glamor_threads.work, &glamor_threads.lock);
+        if (glamor_threads.quit)
+            break;
+        glamor_threads_run_locked();
+    }
+    pthread_mutex_unlock(&glamor_threads.lock);
+    return NULL;
+}
+
+void
+glamor_threads_init(void)
+{
+    char *threads_string;
+    int nthreads;
+    sigset_t set, old;
+
+    if (glamor_threads.users++)
+        return;
+
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    threads_string = getenv("GLAMOR_THREADS");
+    if (threads_string && sscanf(threads_string, "%d", &nthreads) != 1)
+        nthreads = 0;
+    nthreads = MAX(0, MIN(nthreads, GLAMOR_THREADS_MAX));
+
+    /* Leave signal handling to the main thread */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, &old);
+
+    for (glamor_threads.nthreads = 0;
+         glamor_threads.nthreads < nthreads;
+         glamor_threads.nthreads++) {
+        if (pthread_create(&glamor_threads.threads[glamor_threads.nthreads],
+                           NULL, glamor_threads_worker, NULL) != 0)
+            break;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (glamor_threads.nthreads)
+        LogMessageVerb(X_INFO, 3, "glamor: %d worker threads\n",
+                       glamor_threads.nthreads);
+}
+
+void
+glamor_threads_fini(void)
+{
+    int i;
+
+    if (--glamor_threads.users)
+        return;
+
+    pthread_mutex_lock(&glamor_threads.lock);
+    glamor_threads.quit = TRUE;
+    pthread_cond_broadcast(&glamor_threads.work);
+    pthread_mutex_unlock(&glamor_threads.lock);
+
+    for (i = 0; i < glamor_threads.nthreads; i++)
+        pthread_join(glamor_threads.threads[i], NULL);
+
+    glamor_threads.nthreads = 0;
+    glamor_threads.quit = FALSE;
+}
+
+/*
+ * Call func over rows [0, height) split into stripes, spreading them
+ * across the workers when the job touches at least
+ * GLAMOR_THREADS_MIN_BYTES. Returns once all stripes are done.
+ */
+void
+glamor_run_stripes(glamor_stripe_func func, void *closure,
+                   int height, size_t bytes)
+{
+    if (!glamor_threads.nthreads || height < 2 ||
+        bytes < GLAMOR_THREADS_MIN_BYTES) {
+        func(closure, 0, height);
+        return;
+    }
+
+    pthread_mutex_lock(&glamor_threads.lock);
+    glamor_threads.func = func;
+    glamor_threads.closure = closure;
+    glamor_threads.height = height;
+    glamor_threads.next = 0;
+    glamor_threads.nstripes = MIN(glamor_threads.nthreads + 1, height);
+    glamor_threads.pending = glamor_threads.nstripes;
+    pthread_cond_broadcast(&glamor_threads.work);
+
+    /* Take our share instead of sitting idle */
+    glamor_threads_run_locked();
+
+    while (glamor_threads.pending)
+        pthread_cond_wait(&glamor_threads.done, &glamor_threads.lock);
+    pthread_mutex_unlock(&glamor_threads.lock);
+}
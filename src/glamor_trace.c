@@ -0,0 +1,246 @@
+/*
+ * Copyright © 2014 Keith Packard
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include "glamor_priv.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+/*
+ * Timeline of glamor activity.
+ *
+ * With GLAMOR_TRACE set to a number of events, begin and end events
+ * of the main glamor entry points are recorded, along with the client
+ * being served and the size of the work, into a ring holding that many
+ * of the most recent ones. Slots are claimed with an atomic increment,
+ * so recording never takes a lock.
+ *
+ * Sending the server SIGUSR2 writes the ring out at the next block
+ * handler as Chrome trace event JSON, which chrome://tracing and
+ * Perfetto load directly, to GLAMOR_TRACE_FILE (default
+ * /tmp/glamor-trace-<pid>-<n>.json). The ring is also written out when
+ * the last screen closes. The server usually runs as root, so the
+ * default file must not exist yet and no file is written through a
+ * symlink.
+ */
+
+static const struct {
+    const char *name;
+    const char *arg0;
+    const char *arg1;
+} glamor_trace_points[GLAMOR_TRACE_NUM_POINTS] = {
+    [GLAMOR_TRACE_COMPOSITE]    = { "composite",        "width", "height" },
+    [GLAMOR_TRACE_COPY]         = { "copy",             "boxes", "pixels" },
+    [GLAMOR_TRACE_PUT_IMAGE]    = { "put_image",        "width", "height" },
+    [GLAMOR_TRACE_GET_IMAGE]    = { "get_image",        "width", "height" },
+    [GLAMOR_TRACE_PREPARE]      = { "prepare_access",   "width", "height" },
+    [GLAMOR_TRACE_FINISH]       = { "finish_access",    "width", "height" },
+    [GLAMOR_TRACE_VBO]          = { "get_vbo_space",    "bytes", NULL },
+    [GLAMOR_TRACE_FLUSH]        = { "flush",            NULL, NULL },
+    [GLAMOR_TRACE_COMPILE]      = { "compile_shader",   "length", NULL },
+    [GLAMOR_TRACE_LINK]         = { "link_program",     NULL, NULL },
+};
+
+glamor_trace_event *glamor_trace_ring;
+
+static struct {
+    int users;
+    uint64_t size;              /**< power of two */
+    uint64_t head;              /**< events ever recorded */
+    unsigned int dumps;
+    volatile sig_atomic_t dump_requested;
+    OsSigHandlerPtr old_handler;
+} glamor_trace;
+
+static void
+glamor_trace_signal(int signo)
+{
+    glamor_trace.dump_requested = TRUE;
+}
+
+void
+glamor_trace_init(void)
+{
+    char *trace_string;
+    int events;
+
+    if (glamor_trace.users++)
+        return;
+
+    trace_string = getenv("GLAMOR_TRACE");
+    if (!trace_string || sscanf(trace_string, "%d", &events) != 1 ||
+        events <= 0)
+        return;
+
+    for (glamor_trace.size = 1024; glamor_trace.size < events;)
+        glamor_trace.size <<= 1;
+
+    glamor_trace_ring = calloc(glamor_trace.size, sizeof(glamor_trace_event));
+    if (!glamor_trace_ring)
+        return;
+
+    glamor_trace.old_handler = OsSignal(SIGUSR2, glamor_trace_signal);
+    LogMessageVerb(X_INFO, 3,
+                   "glamor: tracing the last %llu events, SIGUSR2 to dump\n",
+                   (unsigned long long) glamor_trace.size);
+}
+
+/*
+ * Claim the next slot and fill it in; seq is written last, so
+ * partially written events are skipped when dumping.
+ */
+void
+glamor_trace_record(glamor_trace_point point, char phase,
+                    int arg0, int arg1)
+{
+    uint64_t index = __atomic_fetch_add(&glamor_trace.head, 1,
+                                        __ATOMIC_RELAXED);
+    glamor_trace_event *event =
+        &glamor_trace_ring[index & (glamor_trace.size - 1)];
+    ClientPtr client = NULL;
+
+#if XORG_VERSION_CURRENT >= 12000000
+    client = GetCurrentClient();
+#endif
+
+    __atomic_store_n(&event->seq, 0, __ATOMIC_RELAXED);
+    event->time = GetTimeInMicros();
+    event->point = point;
+    event->phase = phase;
+    event->client = client ? client->index : -1;
+    event->arg0 = arg0;
+    event->arg1 = arg1;
+    __atomic_store_n(&event->seq, index + 1, __ATOMIC_RELEASE);
+}
+
+static void
+glamor_trace_write_arg(FILE *f, const char *name, int value, Bool *first)
+{
+    if (!name)
+        return;
+    fprintf(f, "%s\"%s\":%d", *first ? "" : ",", name, value);
+    *first = FALSE;
+}
+
+static void
+glamor_trace_dump(void)
+{
+    uint64_t head = __atomic_load_n(&glamor_trace.head, __ATOMIC_ACQUIRE);
+    uint64_t index, start;
+    const glamor_trace_event *event;
+    char *path, *file_string;
+    const char *sep = "";
+    Bool first;
+    FILE *f = NULL;
+    int pid = getpid();
+    int flags = O_WRONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC;
+    int fd;
+
+    file_string = getenv("GLAMOR_TRACE_FILE");
+    if (file_string) {
+        path = strdup(file_string);
+        flags |= O_TRUNC;
+    } else {
+        if (asprintf(&path, "/tmp/glamor-trace-%d-%u.json",
+                     pid, glamor_trace.dumps) < 0)
+            path = NULL;
+        flags |= O_EXCL;
+    }
+    if (!path)
+        return;
+
+    fd = open(path, flags, 0600);
+    if (fd >= 0) {
+        f = fdopen(fd, "w");
+        if (!f)
+            close(fd);
+    }
+    if (!f) {
+        LogMessageVerb(X_WARNING, 1, "glamor: can't write trace to %s\n",
+                       path);
+        free(path);
+        return;
+    }
+
+    fprintf(f, "{\"traceEvents\":[\n");
+
+    start = head > glamor_trace.size ? head - glamor_trace.size : 0;
+    for (index = start; index < head; index++) {
+        event = &glamor_trace_ring[index & (glamor_trace.size - 1)];
+        if (__atomic_load_n(&event->seq, __ATOMIC_ACQUIRE) != index + 1)
+            continue;
+
+        fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu,"
+                "\"pid\":%d,\"tid\":0", sep,
+                glamor_trace_points[event->point].name, event->phase,
+                (unsigned long long) event->time, pid);
+        if (event->phase == 'B') {
+            first = TRUE;
+            fprintf(f, ",\"args\":{");
+            glamor_trace_write_arg(f, "client", event->client, &first);
+            glamor_trace_write_arg(f, glamor_trace_points[event->point].arg0,
+                                   event->arg0, &first);
+            glamor_trace_write_arg(f, glamor_trace_points[event->point].arg1,
+                                   event->arg1, &first);
+            fprintf(f, "}");
+        }
+        fprintf(f, "}");
+        sep = ",\n";
+    }
+
+    fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(f);
+
+    LogMessageVerb(X_INFO, 3, "glamor: wrote trace to %s\n", path);
+    free(path);
+    glamor_trace.dumps++;
+}
+
+/*
+ * Called from the block handler, to write the ring out outside of the
+ * signal handler
+ */
+void
+glamor_trace_block(void)
+{
+    if (!glamor_trace.dump_requested)
+        return;
+    glamor_trace.dump_requested = FALSE;
+    glamor_trace_dump();
+}
+
+void
+glamor_trace_fini(void)
+{
+    if (--glamor_trace.users)
+        return;
+
+    if (!glamor_trace_ring)
+        return;
+
+    OsSignal(SIGUSR2, glamor_trace.old_handler);
+    glamor_trace_dump();
+    free(glamor_trace_ring);
+    glamor_trace_ring = NULL;
+    glamor_trace.head = 0;
+}
@@ -33,6 +33,10 @@ glamor_format_for_pixmap(PixmapPtr pixmap, GLenum *format, GLenum *type)
         *format = GL_BGRA;
         *type = GL_UNSIGNED_BYTE;//GL_UNSIGNED_INT_8_8_8_8_REV;
         break;
+    case 30:
+        *format = GL_BGRA;
+        *type = GL_UNSIGNED_INT_2_10_10_10_REV;
+        break;
     case 16:
         *format = GL_RGB;
         *type = GL_UNSIGNED_SHORT_5_6_5;
@@ -41,6 +45,7 @@ glamor_format_for_pixmap(PixmapPtr pixmap, GLenum *format, GLenum *type)
         *format = GL_BGRA;
         *type = GL_UNSIGNED_SHORT_1_5_5_5_REV;
         break;
+    case 1:
     case 8:
         *format = glamor_get_screen_private(pixmap->drawable.pScreen)->one_channel_format;
         *type = GL_UNSIGNED_BYTE;
@@ -52,25 +57,99 @@ glamor_format_for_pixmap(PixmapPtr pixmap, GLenum *format, GLenum *type)
 }
 
 /*
- * Write a region of bits into a pixmap
+ * Depth 1 pixmaps are stored one byte per pixel on the GPU, 0x00 or
+ * 0xff, and converted to and from the packed form here.
  */
-void
-glamor_upload_boxes(PixmapPtr pixmap, BoxPtr in_boxes, int in_nbox,
-                    int dx_src, int dy_src,
-                    int dx_dst, int dy_dst,
-                    uint8_t *bits, uint32_t byte_stride)
+static inline uint8_t
+glamor_bitmap_bit(int x)
+{
+#if BITMAP_BIT_ORDER == MSBFirst
+    return 0x80 >> (x & 7);
+#else
+    return 1 << (x & 7);
+#endif
+}
+
+static void
+glamor_bitmap_expand(const uint8_t *bits, uint32_t byte_stride,
+                     int x, int y, int w, int h,
+                     uint8_t *bytes, uint32_t bytes_stride)
+{
+    int i, j;
+
+    for (j = 0; j < h; j++) {
+        const uint8_t *row = bits + (y + j) * byte_stride;
+
+        for (i = 0; i < w; i++)
+            bytes[i] = row[(x + i) >> 3] & glamor_bitmap_bit(x + i) ? 0xff : 0x00;
+        bytes += bytes_stride;
+    }
+}
+
+static void
+glamor_bitmap_pack(const uint8_t *bytes, uint32_t bytes_stride,
+                   int x, int y, int w, int h,
+                   uint8_t *bits, uint32_t byte_stride)
+{
+    int i, j;
+
+    for (j = 0; j < h; j++) {
+        uint8_t *row = bits + (y + j) * byte_stride;
+
+        for (i = 0; i < w; i++) {
+            /* Round like pixman does when storing a8 into a1 */
+            if (bytes[i] & 0x80)
+                row[(x + i) >> 3] |= glamor_bitmap_bit(x + i);
+            else
+                row[(x + i) >> 3] &= ~glamor_bitmap_bit(x + i);
+        }
+        bytes += bytes_stride;
+    }
+}
+
+static void
+glamor_upload_boxes_bpp(PixmapPtr pixmap, BoxPtr in_boxes, int in_nbox,
+                        int dx_src, int dy_src,
+                        int dx_dst, int dy_dst,
+                        uint8_t *bits, uint32_t byte_stride,
+                        int bytes_per_pixel)
 {
     ScreenPtr                   screen = pixmap->drawable.pScreen;
     glamor_screen_private       *glamor_priv = glamor_get_screen_private(screen);
     glamor_pixmap_private       *priv = glamor_get_pixmap_private(pixmap);
     int                         box_index;
-    int                         bytes_per_pixel = pixmap->drawable.bitsPerPixel >> 3;
     GLenum                      type;
     GLenum                      format;
 
     glamor_format_for_pixmap(pixmap, &format, &type);
 
     glamor_make_current(glamor_priv);
+    if (priv->readback) {
+        unsigned int serial = priv->serial;
+        RegionRec region;
+
+        RegionInitBoxes(&region, in_boxes, in_nbox);
+        RegionTranslate(&region, dx_dst, dy_dst);
+        glamor_pixmap_invalidate(priv);
+        glamor_readback_damage(priv, serial, RegionExtents(&region));
+        RegionUninit(&region);
+    } else
+        glamor_pixmap_invalidate(priv);
+
+    /* Only copy what the upload leaves alone */
+    if (priv->fbo && priv->fbo->shared) {
+        RegionRec region;
+        Bool unshared;
+
+        RegionInitBoxes(&region, in_boxes, in_nbox);
+        RegionTranslate(&region, dx_dst, dy_dst);
+        unshared = glamor_pixmap_unshare_fbo(pixmap, &region);
+        RegionUninit(&region);
+
+        /* Callers that can fall back have unshared already */
+        if (!unshared)
+            return;
+    }
 
     glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
@@ -123,6 +202,65 @@ glamor_upload_boxes(PixmapPtr pixmap, BoxPtr in_boxes, int in_nbox,
         glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 }
 
+/*
+ * Expand each box of a packed bitmap into bytes and upload that
+ */
+static void
+glamor_upload_bitmap_boxes(PixmapPtr pixmap, BoxPtr boxes, int nbox,
+                           int dx_src, int dy_src,
+                           int dx_dst, int dy_dst,
+                           uint8_t *bits, uint32_t byte_stride)
+{
+    while (nbox--) {
+        BoxRec box;
+        uint32_t stride;
+        uint8_t *bytes;
+
+        box.x1 = MAX(boxes->x1 + dx_dst, 0);
+        box.y1 = MAX(boxes->y1 + dy_dst, 0);
+        box.x2 = MIN(boxes->x2 + dx_dst, pixmap->drawable.width);
+        box.y2 = MIN(boxes->y2 + dy_dst, pixmap->drawable.height);
+        boxes++;
+
+        if (box.x2 <= box.x1 || box.y2 <= box.y1)
+            continue;
+
+        stride = ALIGN(box.x2 - box.x1, 4);
+        bytes = xallocarray(box.y2 - box.y1, stride);
+        if (!bytes)
+            continue;
+
+        glamor_bitmap_expand(bits, byte_stride,
+                             box.x1 - dx_dst + dx_src,
+                             box.y1 - dy_dst + dy_src,
+                             box.x2 - box.x1, box.y2 - box.y1,
+                             bytes, stride);
+        glamor_upload_boxes_bpp(pixmap, &box, 1, -box.x1, -box.y1, 0, 0,
+                                bytes, stride, 1);
+        free(bytes);
+    }
+}
+
+/*
+ * Write a region of bits into a pixmap
+ */
+void
+glamor_upload_boxes(PixmapPtr pixmap, BoxPtr in_boxes, int in_nbox,
+                    int dx_src, int dy_src,
+                    int dx_dst, int dy_dst,
+                    uint8_t *bits, uint32_t byte_stride)
+{
+    if (pixmap->drawable.bitsPerPixel == 1)
+        glamor_upload_bitmap_boxes(pixmap, in_boxes, in_nbox,
+                                   dx_src, dy_src, dx_dst, dy_dst,
+                                   bits, byte_stride);
+    else
+        glamor_upload_boxes_bpp(pixmap, in_boxes, in_nbox,
+                                dx_src, dy_src, dx_dst, dy_dst,
+                                bits, byte_stride,
+                                pixmap->drawable.bitsPerPixel >> 3);
+}
+
 /*
  * Upload a region of data
  */
@@ -155,19 +293,56 @@ glamor_upload_pixmap(PixmapPtr pixmap)
 }
 
 /*
- * Read stuff from the pixmap FBOs and write to memory
+ * Copy the contents of a memory pixmap into a texture of the same
+ * size which isn't attached to it, leaving the pixmap untouched.
  */
 void
-glamor_download_boxes(PixmapPtr pixmap, BoxPtr in_boxes, int in_nbox,
-                      int dx_src, int dy_src,
-                      int dx_dst, int dy_dst,
-                      uint8_t *bits, uint32_t byte_stride)
+glamor_upload_pixmap_to_fbo(PixmapPtr pixmap, glamor_pixmap_fbo *fbo)
+{
+    ScreenPtr                   screen = pixmap->drawable.pScreen;
+    glamor_screen_private       *glamor_priv = glamor_get_screen_private(screen);
+    int                         bytes_per_pixel = pixmap->drawable.bitsPerPixel >> 3;
+    int                         width = pixmap->drawable.width;
+    int                         height = pixmap->drawable.height;
+    uint8_t                     *bits = pixmap->devPrivate.ptr;
+    GLenum                      type;
+    GLenum                      format;
+    int                         y;
+
+    glamor_format_for_pixmap(pixmap, &format, &type);
+
+    glamor_make_current(glamor_priv);
+    glamor_bind_texture(glamor_priv, GL_TEXTURE0, fbo, TRUE);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    if (glamor_priv->has_unpack_subimage ||
+        width == pixmap->devKind / bytes_per_pixel) {
+        if (glamor_priv->has_unpack_subimage)
+            glPixelStorei(GL_UNPACK_ROW_LENGTH,
+                          pixmap->devKind / bytes_per_pixel);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height,
+                        format, type, bits);
+        if (glamor_priv->has_unpack_subimage)
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    } else {
+        for (y = 0; y < height; y++, bits += pixmap->devKind)
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, width, 1,
+                            format, type, bits);
+    }
+}
+
+static void
+glamor_download_boxes_bpp(PixmapPtr pixmap, BoxPtr in_boxes, int in_nbox,
+                          int dx_src, int dy_src,
+                          int dx_dst, int dy_dst,
+                          uint8_t *bits, uint32_t byte_stride,
+                          int bytes_per_pixel)
 {
     ScreenPtr screen = pixmap->drawable.pScreen;
     glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
     glamor_pixmap_private *priv = glamor_get_pixmap_private(pixmap);
     int box_index;
-    int bytes_per_pixel = pixmap->drawable.bitsPerPixel >> 3;
     GLenum type;
     GLenum format;
 
@@ -217,6 +392,65 @@ glamor_download_boxes(PixmapPtr pixmap, BoxPtr in_boxes, int in_nbox,
         glPixelStorei(GL_PACK_ROW_LENGTH, 0);
 }
 
+/*
+ * Read each box as bytes and pack them into the bitmap
+ */
+static void
+glamor_download_bitmap_boxes(PixmapPtr pixmap, BoxPtr boxes, int nbox,
+                             int dx_src, int dy_src,
+                             int dx_dst, int dy_dst,
+                             uint8_t *bits, uint32_t byte_stride)
+{
+    while (nbox--) {
+        BoxRec box;
+        uint32_t stride;
+        uint8_t *bytes;
+
+        box.x1 = MAX(boxes->x1 + dx_src, 0);
+        box.y1 = MAX(boxes->y1 + dy_src, 0);
+        box.x2 = MIN(boxes->x2 + dx_src, pixmap->drawable.width);
+        box.y2 = MIN(boxes->y2 + dy_src, pixmap->drawable.height);
+        boxes++;
+
+        if (box.x2 <= box.x1 || box.y2 <= box.y1)
+            continue;
+
+        stride = ALIGN(box.x2 - box.x1, 4);
+        bytes = xallocarray(box.y2 - box.y1, stride);
+        if (!bytes)
+            continue;
+
+        glamor_download_boxes_bpp(pixmap, &box, 1, 0, 0, -box.x1, -box.y1,
+                                  bytes, stride, 1);
+        glamor_bitmap_pack(bytes, stride,
+                           box.x1 - dx_src + dx_dst,
+                           box.y1 - dy_src + dy_dst,
+                           box.x2 - box.x1, box.y2 - box.y1,
+                           bits, byte_stride);
+        free(bytes);
+    }
+}
+
+/*
+ * Read stuff from the pixmap FBOs and write to memory
+ */
+void
+glamor_download_boxes(PixmapPtr pixmap, BoxPtr in_boxes, int in_nbox,
+                      int dx_src, int dy_src,
+                      int dx_dst, int dy_dst,
+                      uint8_t *bits, uint32_t byte_stride)
+{
+    if (pixmap->drawable.bitsPerPixel == 1)
+        glamor_download_bitmap_boxes(pixmap, in_boxes, in_nbox,
+                                     dx_src, dy_src, dx_dst, dy_dst,
+                                     bits, byte_stride);
+    else
+        glamor_download_boxes_bpp(pixmap, in_boxes, in_nbox,
+                                  dx_src, dy_src, dx_dst, dy_dst,
+                                  bits, byte_stride,
+                                  pixmap->drawable.bitsPerPixel >> 3);
+}
+
 /*
  * Read data from the pixmap FBO
  */
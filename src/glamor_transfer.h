@@ -40,6 +40,9 @@ glamor_upload_region(PixmapPtr pixmap, RegionPtr region,
 void
 glamor_upload_pixmap(PixmapPtr pixmap);
 
+void
+glamor_upload_pixmap_to_fbo(PixmapPtr pixmap, glamor_pixmap_fbo *fbo);
+
 void
 glamor_download_boxes(PixmapPtr pixmap, BoxPtr in_boxes, int in_nbox,
                       int dx_src, int dy_src,
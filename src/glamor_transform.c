@@ -22,6 +22,7 @@
 
 #include "glamor_priv.h"
 #include "glamor_transform.h"
+#include "glamor_transfer.h"
 
 
 /*
@@ -53,9 +54,16 @@ glamor_set_destination_drawable(DrawablePtr     drawable,
     float scale_x = 2.0f / (float) w;
     float scale_y = 2.0f / (float) h;
     float center_adjust = 0.0f;
+    BoxRec damage;
 
     glamor_get_drawable_deltas(drawable, pixmap, &off_x, &off_y);
 
+    /* Drawing is clipped to the drawable */
+    damage.x1 = drawable->x + off_x;
+    damage.y1 = drawable->y + off_y;
+    damage.x2 = damage.x1 + drawable->width;
+    damage.y2 = damage.y1 + drawable->height;
+
     off_x -= box->x1;
     off_y -= box->y1;
 
@@ -94,6 +102,7 @@ glamor_set_destination_drawable(DrawablePtr     drawable,
                 scale_x, (off_x + center_adjust) * scale_x - 1.0f,
                 scale_y, (off_y + center_adjust) * scale_y - 1.0f);
 
+    glamor_pixmap_begin_write(pixmap, pixmap_priv, &damage);
     glamor_set_destination_pixmap_fbo(glamor_priv, glamor_pixmap_fbo_at(pixmap_priv, box_index),
                                       0, 0, w, h);
 }
@@ -197,24 +206,139 @@ glamor_set_texture(PixmapPtr    texture,
     return TRUE;
 }
 
+/*
+ * Tiles kept in system memory are uploaded into a texture held with
+ * the pixmap, which is reused until the pixmap contents change. Only
+ * storage allocated by fb is cached: other storage, like shared memory,
+ * is written by the client without bumping the serial, so it is
+ * uploaded on every use.
+ */
+static glamor_pixmap_fbo *
+glamor_get_tile_fbo(PixmapPtr tile)
+{
+    glamor_screen_private *glamor_priv =
+        glamor_get_screen_private(tile->drawable.pScreen);
+    glamor_pixmap_private *tile_priv = glamor_get_pixmap_private(tile);
+
+    if (tile_priv->tile_fbo && tile_priv->fb_bits &&
+        tile->devPrivate.ptr == tile_priv->fb_bits &&
+        tile_priv->tile_serial == tile_priv->serial)
+        return tile_priv->tile_fbo;
+
+    if (tile_priv->type != GLAMOR_MEMORY || !tile->devPrivate.ptr ||
+        tile->drawable.bitsPerPixel < 8)
+        return NULL;
+
+    if (!glamor_check_fbo_size(glamor_priv,
+                               tile->drawable.width, tile->drawable.height))
+        return NULL;
+
+    if (!tile_priv->tile_fbo) {
+        tile_priv->tile_fbo = glamor_create_fbo(glamor_priv,
+                                                tile->drawable.width,
+                                                tile->drawable.height,
+                                                gl_iformat_for_pixmap(tile),
+                                                GLAMOR_CREATE_FBO_NO_FBO);
+        if (!tile_priv->tile_fbo)
+            return NULL;
+    }
+
+    glamor_upload_pixmap_to_fbo(tile, tile_priv->tile_fbo);
+    tile_priv->tile_serial = tile_priv->serial;
+    return tile_priv->tile_fbo;
+}
+
 Bool
 glamor_set_tiled(PixmapPtr      pixmap,
                  GCPtr          gc,
                  GLint          offset_uniform,
                  GLint          size_inv_uniform)
 {
+    PixmapPtr tile = gc->tile.pixmap;
+    glamor_pixmap_fbo *fbo;
+
     if (!glamor_set_alu(pixmap->drawable.pScreen, gc->alu))
         return FALSE;
 
     if (!glamor_set_planemask(gc->depth, gc->planemask))
         return FALSE;
 
-    return glamor_set_texture(gc->tile.pixmap,
-                              TRUE,
-                              -gc->patOrg.x,
-                              -gc->patOrg.y,
-                              offset_uniform,
-                              size_inv_uniform);
+    if (!glamor_pixmap_thaw(tile))
+        return FALSE;
+
+    if (glamor_pixmap_has_fbo(tile))
+        return glamor_set_texture(tile,
+                                  TRUE,
+                                  -gc->patOrg.x,
+                                  -gc->patOrg.y,
+                                  offset_uniform,
+                                  size_inv_uniform);
+
+    fbo = glamor_get_tile_fbo(tile);
+    if (!fbo)
+        return FALSE;
+
+    glamor_bind_texture(glamor_get_screen_private(pixmap->drawable.pScreen),
+                        GL_TEXTURE0, fbo, TRUE);
+    glUniform2f(offset_uniform, -gc->patOrg.x, -gc->patOrg.y);
+    glUniform2f(size_inv_uniform,
+                1.0f/tile->drawable.width, 1.0f/tile->drawable.height);
+    return TRUE;
+}
+
+/*
+ * Bind the FBOs of a large tile to texture units 0-3, in row order,
+ * for the tile_array fill. Tiles of more than 2x2 FBOs aren't
+ * handled.
+ */
+Bool
+glamor_set_tile_array(PixmapPtr pixmap,
+                      GCPtr     gc,
+                      GLint     offset_uniform,
+                      GLint     size_inv_uniform,
+                      GLint     block_uniform,
+                      GLint     tiles_uniform)
+{
+    static const GLint units[3] = { 1, 2, 3 };
+    glamor_screen_private *glamor_priv =
+        glamor_get_screen_private(pixmap->drawable.pScreen);
+    PixmapPtr tile = gc->tile.pixmap;
+    glamor_pixmap_private *tile_priv = glamor_get_pixmap_private(tile);
+    int wcnt = glamor_pixmap_wcnt(tile_priv);
+    int hcnt = glamor_pixmap_hcnt(tile_priv);
+    BoxPtr first;
+    int i;
+
+    if (!glamor_set_alu(pixmap->drawable.pScreen, gc->alu))
+        return FALSE;
+
+    if (!glamor_set_planemask(gc->depth, gc->planemask))
+        return FALSE;
+
+    if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(tile_priv) || wcnt > 2 || hcnt > 2)
+        return FALSE;
+
+    /* Missing columns or rows get the first FBO, which is never
+     * sampled. Go backwards to leave unit 0 active.
+     */
+    for (i = 3; i >= 0; i--) {
+        int x = i & 1;
+        int y = i >> 1;
+        int idx = (x < wcnt && y < hcnt) ? y * wcnt + x : 0;
+
+        glamor_bind_texture(glamor_priv, GL_TEXTURE0 + i,
+                            glamor_pixmap_fbo_at(tile_priv, idx), TRUE);
+    }
+
+    first = glamor_pixmap_box_at(tile_priv, 0);
+    glUniform1iv(tiles_uniform, 3, units);
+    glUniform2f(block_uniform,
+                (float) (first->x2 - first->x1) / tile->drawable.width,
+                (float) (first->y2 - first->y1) / tile->drawable.height);
+    glUniform2f(offset_uniform, -gc->patOrg.x, -gc->patOrg.y);
+    glUniform2f(size_inv_uniform,
+                1.0f/tile->drawable.width, 1.0f/tile->drawable.height);
+    return TRUE;
 }
 
 static PixmapPtr
@@ -234,6 +358,11 @@ glamor_get_stipple_pixmap(GCPtr gc)
     if (!bitmap)
         goto bail;
 
+    /* A GPU bitmap already holds 0x00/0xff per pixel, the same as the
+     * converted copy below */
+    if (GLAMOR_PIXMAP_PRIV_HAS_FBO(glamor_get_pixmap_private(bitmap)))
+        return bitmap;
+
     pixmap = glamor_create_pixmap(screen,
                                   bitmap->drawable.width,
                                   bitmap->drawable.height,
@@ -71,6 +71,14 @@ glamor_set_tiled(PixmapPtr      pixmap,
                  GLint          offset_uniform,
                  GLint          size_uniform);
 
+Bool
+glamor_set_tile_array(PixmapPtr pixmap,
+                      GCPtr     gc,
+                      GLint     offset_uniform,
+                      GLint     size_uniform,
+                      GLint     block_uniform,
+                      GLint     tiles_uniform);
+
 Bool
 glamor_set_stippled(PixmapPtr      pixmap,
                     GCPtr          gc,
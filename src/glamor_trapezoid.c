@@ -31,10 +31,263 @@
  */
 
 #include "glamor_priv.h"
+#include "glamor_transfer.h"
 
 #include "mipict.h"
 #include "fbpict.h"
 
+/*
+ * Cache of small anti-aliased trapezoid masks.
+ *
+ * Toolkits draw the same shapes over and over (button corners, check
+ * marks, radio circles). Masks of up to GLAMOR_TRAP_CACHE_CELL pixels
+ * square are kept in one A8 atlas, one cell each, keyed by the
+ * trapezoids translated to the mask origin. Translating by whole
+ * pixels keeps the subpixel phase in the key, so a hit is always
+ * pixel-exact. The least recently used cell is replaced on a miss.
+ */
+
+#define GLAMOR_TRAP_CACHE_CELL          32
+#define GLAMOR_TRAP_CACHE_DIM           512
+#define GLAMOR_TRAP_CACHE_ROW           (GLAMOR_TRAP_CACHE_DIM / GLAMOR_TRAP_CACHE_CELL)
+#define GLAMOR_TRAP_CACHE_NCELL         (GLAMOR_TRAP_CACHE_ROW * GLAMOR_TRAP_CACHE_ROW)
+#define GLAMOR_TRAP_CACHE_MAX_TRAPS     16
+
+struct glamor_trap_cache_entry {
+    uint32_t            hash;
+    int                 width, height;
+    int                 ntrap;
+    xTrapezoid          traps[GLAMOR_TRAP_CACHE_MAX_TRAPS];
+    unsigned long       last_use;       /* zero when the cell is free */
+};
+
+struct glamor_trap_cache {
+    PicturePtr          picture;
+    unsigned long       clock;
+    unsigned long       hits;
+    unsigned long       misses;
+    unsigned long       evictions;
+    Bool                trimmed;        /* picture freed by glamor_trap_cache_trim() */
+    struct glamor_trap_cache_entry entries[GLAMOR_TRAP_CACHE_NCELL];
+};
+
+static struct glamor_trap_cache *
+glamor_trap_cache_get(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    struct glamor_trap_cache *cache = glamor_priv->trap_cache;
+    PictFormatPtr format;
+    PixmapPtr atlas;
+    int error;
+
+    if (cache && (cache->picture || !cache->trimmed))
+        return cache->picture ? cache : NULL;
+
+    if (cache) {
+        cache->trimmed = FALSE;
+    } else {
+        cache = calloc(1, sizeof (*cache));
+        if (!cache)
+            return NULL;
+        glamor_priv->trap_cache = cache;
+    }
+
+    format = PictureMatchFormat(screen, 8, PICT_a8);
+    if (!format)
+        return NULL;
+
+    atlas = glamor_create_pixmap(screen,
+                                 GLAMOR_TRAP_CACHE_DIM, GLAMOR_TRAP_CACHE_DIM,
+                                 8, GLAMOR_CREATE_FBO_NO_FBO);
+    if (!atlas)
+        return NULL;
+
+    /* The atlas may end up in fb fallbacks, which need a framebuffer */
+    if (!glamor_pixmap_has_fbo(atlas) ||
+        !glamor_pixmap_ensure_fbo(atlas, glamor_priv->one_channel_format, 0)) {
+        glamor_destroy_pixmap(atlas);
+        return NULL;
+    }
+
+    cache->picture = CreatePicture(0, &atlas->drawable, format, 0, 0,
+                                   serverClient, &error);
+    glamor_destroy_pixmap(atlas);
+
+    return cache->picture ? cache : NULL;
+}
+
+void
+glamor_trap_cache_fini(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    struct glamor_trap_cache *cache = glamor_priv->trap_cache;
+
+    if (!cache)
+        return;
+
+    LogMessageVerb(X_INFO, 3,
+                   "glamor%d: trapezoid mask cache: %lu hits, %lu misses, "
+                   "%lu evictions\n", screen->myNum,
+                   cache->hits, cache->misses, cache->evictions);
+
+    if (cache->picture)
+        FreePicture(cache->picture, 0);
+    free(cache);
+    glamor_priv->trap_cache = NULL;
+}
+
+/*
+ * Free the cache contents under memory pressure, keeping the
+ * statistics. The next trapezoids call starts over with an empty atlas.
+ */
+void
+glamor_trap_cache_trim(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    struct glamor_trap_cache *cache = glamor_priv->trap_cache;
+
+    if (!cache || !cache->picture)
+        return;
+
+    FreePicture(cache->picture, 0);
+    cache->picture = NULL;
+    memset(cache->entries, 0, sizeof(cache->entries));
+    cache->trimmed = TRUE;
+}
+
+static uint32_t
+glamor_trap_cache_hash(const void *data, size_t size, uint32_t hash)
+{
+    const uint8_t *p = data;
+
+    /* FNV-1a */
+    while (size--)
+        hash = (hash ^ *p++) * 16777619;
+    return hash;
+}
+
+/*
+ * Composite the traps through a cached mask. Returns FALSE when
+ * the traps aren't suitable for caching and the caller should
+ * rasterize them as usual.
+ */
+static Bool
+glamor_trap_cache_composite(CARD8 op, PicturePtr src, PicturePtr dst,
+                            PictFormatPtr mask_format,
+                            INT16 x_src, INT16 y_src,
+                            int ntrap, xTrapezoid *traps, BoxPtr bounds)
+{
+    ScreenPtr screen = dst->pDrawable->pScreen;
+    struct glamor_trap_cache *cache;
+    struct glamor_trap_cache_entry *entry, *victim;
+    xTrapezoid key[GLAMOR_TRAP_CACHE_MAX_TRAPS];
+    pixman_fixed_t dx, dy;
+    int width = bounds->x2 - bounds->x1;
+    int height = bounds->y2 - bounds->y1;
+    uint32_t hash;
+    int cell, cell_x, cell_y;
+    int i;
+
+    if (mask_format->format != PICT_a8)
+        return FALSE;
+
+    if (width > GLAMOR_TRAP_CACHE_CELL || height > GLAMOR_TRAP_CACHE_CELL ||
+        ntrap > GLAMOR_TRAP_CACHE_MAX_TRAPS)
+        return FALSE;
+
+    /* Uploading a cell only pays off when the destination is on the GPU */
+    if (!glamor_pixmap_has_fbo(glamor_get_drawable_pixmap(dst->pDrawable)))
+        return FALSE;
+
+    cache = glamor_trap_cache_get(screen);
+    if (!cache)
+        return FALSE;
+
+    dx = pixman_int_to_fixed(bounds->x1);
+    dy = pixman_int_to_fixed(bounds->y1);
+    for (i = 0; i < ntrap; i++) {
+        key[i].top = traps[i].top - dy;
+        key[i].bottom = traps[i].bottom - dy;
+        key[i].left.p1.x = traps[i].left.p1.x - dx;
+        key[i].left.p1.y = traps[i].left.p1.y - dy;
+        key[i].left.p2.x = traps[i].left.p2.x - dx;
+        key[i].left.p2.y = traps[i].left.p2.y - dy;
+        key[i].right.p1.x = traps[i].right.p1.x - dx;
+        key[i].right.p1.y = traps[i].right.p1.y - dy;
+        key[i].right.p2.x = traps[i].right.p2.x - dx;
+        key[i].right.p2.y = traps[i].right.p2.y - dy;
+    }
+
+    hash = glamor_trap_cache_hash(key, ntrap * sizeof (xTrapezoid),
+                                  2166136261u);
+
+    victim = NULL;
+    for (cell = 0; cell < GLAMOR_TRAP_CACHE_NCELL; cell++) {
+        entry = &cache->entries[cell];
+
+        if (entry->last_use && entry->hash == hash &&
+            entry->width == width && entry->height == height &&
+            entry->ntrap == ntrap &&
+            memcmp(entry->traps, key, ntrap * sizeof (xTrapezoid)) == 0)
+            break;
+
+        if (!victim || entry->last_use < victim->last_use)
+            victim = entry;
+    }
+
+    if (cell < GLAMOR_TRAP_CACHE_NCELL) {
+        cache->hits++;
+        cell_x = (cell % GLAMOR_TRAP_CACHE_ROW) * GLAMOR_TRAP_CACHE_CELL;
+        cell_y = (cell / GLAMOR_TRAP_CACHE_ROW) * GLAMOR_TRAP_CACHE_CELL;
+    } else {
+        PixmapPtr atlas = glamor_get_drawable_pixmap(cache->picture->pDrawable);
+        int stride = PixmapBytePad(width, 8);
+        pixman_image_t *image;
+        BoxRec box;
+
+        image = pixman_image_create_bits(PICT_a8, width, height, NULL, stride);
+        if (!image)
+            return FALSE;
+
+        for (i = 0; i < ntrap; i++)
+            pixman_rasterize_trapezoid(image, (pixman_trapezoid_t *) &key[i],
+                                       0, 0);
+
+        entry = victim;
+        cell = entry - cache->entries;
+        cell_x = (cell % GLAMOR_TRAP_CACHE_ROW) * GLAMOR_TRAP_CACHE_CELL;
+        cell_y = (cell / GLAMOR_TRAP_CACHE_ROW) * GLAMOR_TRAP_CACHE_CELL;
+
+        box.x1 = 0;
+        box.y1 = 0;
+        box.x2 = width;
+        box.y2 = height;
+        glamor_upload_boxes(atlas, &box, 1, 0, 0, cell_x, cell_y,
+                            (uint8_t *) pixman_image_get_data(image), stride);
+        pixman_image_unref(image);
+
+        if (entry->last_use)
+            cache->evictions++;
+        cache->misses++;
+
+        entry->hash = hash;
+        entry->width = width;
+        entry->height = height;
+        entry->ntrap = ntrap;
+        memcpy(entry->traps, key, ntrap * sizeof (xTrapezoid));
+    }
+
+    entry->last_use = ++cache->clock;
+
+    CompositePicture(op, src, cache->picture, dst,
+                     bounds->x1 + x_src - (traps[0].left.p1.x >> 16),
+                     bounds->y1 + y_src - (traps[0].left.p1.y >> 16),
+                     cell_x, cell_y,
+                     bounds->x1, bounds->y1,
+                     width, height);
+    return TRUE;
+}
+
 /**
  * Creates an appropriate picture for temp mask use.
  */
@@ -69,6 +322,45 @@ glamor_create_mask_picture(ScreenPtr screen,
     return picture;
 }
 
+struct glamor_trap_job {
+    pixman_format_code_t format;
+    uint8_t *bits;
+    int width;
+    int stride;
+    int ntrap;
+    xTrapezoid *traps;
+    int x_off, y_off;
+    Bool failed;                /**< a stripe couldn't be rasterized */
+};
+
+/*
+ * Rasterize every trapezoid into rows [y1, y2) of the mask. pixman
+ * clips each one to the stripe, so traps outside it cost little.
+ * Stripes that can't wrap their rows in an image flag the job failed.
+ */
+static void
+glamor_trap_stripe(void *closure, int y1, int y2)
+{
+    struct glamor_trap_job *job = closure;
+    pixman_image_t *image;
+    int i;
+
+    image = pixman_image_create_bits(job->format, job->width, y2 - y1,
+                                     (uint32_t *) (job->bits +
+                                                   y1 * job->stride),
+                                     job->stride);
+    if (!image) {
+        __atomic_store_n(&job->failed, TRUE, __ATOMIC_RELAXED);
+        return;
+    }
+
+    for (i = 0; i < job->ntrap; i++)
+        pixman_rasterize_trapezoid(image,
+                                   (pixman_trapezoid_t *) &job->traps[i],
+                                   job->x_off, job->y_off - y1);
+    pixman_image_unref(image);
+}
+
 /**
  * glamor_trapezoids will generate trapezoid mask accumulating in
  * system memory.
@@ -87,6 +379,7 @@ glamor_trapezoids(CARD8 op,
     int width, height, stride;
     PixmapPtr pixmap;
     pixman_image_t *image = NULL;
+    struct glamor_trap_job job;
 
     /* If a mask format wasn't provided, we get to choose, but behavior should
      * be as if there was no temporary mask the traps were accumulated into.
@@ -107,6 +400,10 @@ glamor_trapezoids(CARD8 op,
     if (bounds.y1 >= bounds.y2 || bounds.x1 >= bounds.x2)
         return;
 
+    if (glamor_trap_cache_composite(op, src, dst, mask_format, x_src, y_src,
+                                    ntrap, traps, &bounds))
+        return;
+
     x_dst = traps[0].left.p1.x >> 16;
     y_dst = traps[0].left.p1.y >> 16;
 
@@ -126,10 +423,28 @@ glamor_trapezoids(CARD8 op,
         return;
     }
 
-    for (; ntrap; ntrap--, traps++)
-        pixman_rasterize_trapezoid(image,
-                                   (pixman_trapezoid_t *) traps,
-                                   -bounds.x1, -bounds.y1);
+    job.format = picture->format;
+    job.bits = (uint8_t *) pixman_image_get_data(image);
+    job.width = width;
+    job.stride = pixman_image_get_stride(image);
+    job.ntrap = ntrap;
+    job.traps = traps;
+    job.x_off = -bounds.x1;
+    job.y_off = -bounds.y1;
+    job.failed = FALSE;
+    glamor_run_stripes(glamor_trap_stripe, &job, height,
+                       (size_t) height * stride * ntrap);
+
+    /* Start over on the whole mask rather than draw it with holes */
+    if (job.failed) {
+        int i;
+
+        memset(job.bits, 0, (size_t) height * job.stride);
+        for (i = 0; i < ntrap; i++)
+            pixman_rasterize_trapezoid(image,
+                                       (pixman_trapezoid_t *) &traps[i],
+                                       job.x_off, job.y_off);
+    }
 
     pixmap = glamor_get_drawable_pixmap(picture->pDrawable);
 
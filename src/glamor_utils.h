@@ -574,7 +574,8 @@
                                                     && (_w_) <= _glamor_->max_fbo_size  \
                                                     && (_h_) <= _glamor_->max_fbo_size)
 
-/* For 1bpp pixmap, we don't store it as texture. */
+/* 1bpp pixmaps are only stored as textures with GLAMOR_GPU_BITMAPS,
+ * see glamor_create_pixmap. */
 #define glamor_check_pixmap_fbo_depth(_depth_) (			\
 						_depth_ == 8		\
 						|| _depth_ == 15	\
@@ -621,7 +622,12 @@ gl_iformat_for_pixmap(PixmapPtr pixmap)
         glamor_get_screen_private((pixmap)->drawable.pScreen);
 
     if (((pixmap)->drawable.depth == 1 || (pixmap)->drawable.depth == 8)) {
-        return GL_ALPHA;
+        /* Must match what glamor_format_for_pixmap transfers */
+        return glamor_priv->one_channel_format;
+    } else if ((pixmap)->drawable.depth == 16 && glamor_priv->has_rgb565) {
+        return GL_RGB;
+    } else if ((pixmap)->drawable.depth == 30 && glamor_priv->has_rgb10_a2) {
+        return GL_RGB10_A2;
     } else {
         return GL_RGBA;
     }
@@ -723,8 +729,9 @@ static inline void
 glamor_make_current(glamor_screen_private *glamor_priv)
 {
     if (lastGLContext != &glamor_priv->ctx) {
-        lastGLContext = &glamor_priv->ctx;
+        /* make_current may look at the outgoing context */
         glamor_priv->ctx.make_current(&glamor_priv->ctx);
+        lastGLContext = &glamor_priv->ctx;
     }
 }
 
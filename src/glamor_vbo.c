@@ -49,6 +49,7 @@ glamor_get_vbo_space(ScreenPtr screen, unsigned size, char **vbo_offset)
     void *data;
 
     glamor_make_current(glamor_priv);
+    glamor_trace_begin(GLAMOR_TRACE_VBO, size, 0);
 
     glBindBuffer(GL_ARRAY_BUFFER, glamor_priv->vbo);
 
@@ -80,6 +81,7 @@ glamor_get_vbo_space(ScreenPtr screen, unsigned size, char **vbo_offset)
                     glamor_priv->has_buffer_storage = false;
                     glamor_priv->vbo_size = 0;
 
+                    glamor_trace_end(GLAMOR_TRACE_VBO);
                     return glamor_get_vbo_space(screen, size, vbo_offset);
                 }
             }
@@ -102,8 +104,10 @@ glamor_get_vbo_space(ScreenPtr screen, unsigned size, char **vbo_offset)
          * version, Mesa would sometimes throw errors on unmapping a
          * zero-size mapping.
          */
-        if (size == 0)
+        if (size == 0) {
+            glamor_trace_end(GLAMOR_TRACE_VBO);
             return NULL;
+        }
 
         if (glamor_priv->vbo_size < glamor_priv->vbo_offset + size) {
             glamor_priv->vbo_size = MAX(GLAMOR_VBO_SIZE, size);
@@ -138,6 +142,7 @@ glamor_get_vbo_space(ScreenPtr screen, unsigned size, char **vbo_offset)
         data = glamor_priv->vb;
     }
 
+    glamor_trace_end(GLAMOR_TRACE_VBO);
     return data;
 }
 
@@ -166,6 +171,39 @@ glamor_put_vbo_space(ScreenPtr screen)
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
+/**
+ * Drops a VBO that grew past the default size, under memory pressure.
+ * The next glamor_get_vbo_space() starts over with a default sized one.
+ */
+void
+glamor_trim_vbo(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+
+    if (glamor_priv->vbo_size <= GLAMOR_VBO_SIZE)
+        return;
+
+    glamor_make_current(glamor_priv);
+
+    if (glamor_priv->has_buffer_storage) {
+        glBindBuffer(GL_ARRAY_BUFFER, glamor_priv->vbo);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glDeleteBuffers(1, &glamor_priv->vbo);
+        glGenBuffers(1, &glamor_priv->vbo);
+        glamor_priv->vb = NULL;
+    } else if (glamor_priv->has_map_buffer_range) {
+        glBindBuffer(GL_ARRAY_BUFFER, glamor_priv->vbo);
+        glBufferData(GL_ARRAY_BUFFER, 0, NULL, GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    } else {
+        free(glamor_priv->vb);
+        glamor_priv->vb = NULL;
+    }
+    glamor_priv->vbo_size = 0;
+    glamor_priv->vbo_offset = 0;
+}
+
 void
 glamor_init_vbo(ScreenPtr screen)
 {
@@ -0,0 +1,319 @@
+/*
+ * Copyright © 2014 Keith Packard
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include "glamor_priv.h"
+#include "glamor_transfer.h"
+
+/*
+ * Check accelerated rendering against fb.
+ *
+ * With GLAMOR_VERIFY=n set, one in every n operations that have both
+ * a GL path and an fb fallback is run twice: the destination area is
+ * saved, the GL path runs and its result is read back, the saved
+ * contents are put back and the fb path runs on the same input. The
+ * two results are compared pixel by pixel and any difference is
+ * logged, along with the time each side took. Run the server on
+ * llvmpipe and any client workload to exercise it.
+ *
+ * Callers look like
+ *
+ *      glamor_verify_begin(drawable, boxes, nbox, &verify);
+ *      if (glamor_foo_gl(...) && !glamor_verify_check(&verify))
+ *          return;
+ *      glamor_foo_bail(...);
+ *      glamor_verify_end(&verify, "foo");
+ */
+
+/* Operations nested inside a checked one are left alone */
+static int glamor_verify_depth;
+
+void
+glamor_verify_init(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    char *verify_string;
+    int interval;
+
+    verify_string = getenv("GLAMOR_VERIFY");
+    if (verify_string && sscanf(verify_string, "%d", &interval) == 1 &&
+        interval > 0) {
+        glamor_priv->verify_interval = interval;
+        LogMessageVerb(X_WARNING, 0,
+                       "glamor%d: checking 1 in %d operations against fb\n",
+                       screen->myNum, interval);
+    }
+}
+
+void
+glamor_verify_fini(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    int i;
+
+    for (i = 0; i < GLAMOR_VERIFY_MAX_OPS; i++) {
+        struct glamor_verify_stats *stats = &glamor_priv->verify_stats[i];
+
+        if (!stats->name)
+            break;
+
+        LogMessageVerb(X_INFO, 0,
+                       "glamor%d: verify %s: %lu checked, %lu mismatched, "
+                       "%llu us gl, %llu us fb\n", screen->myNum,
+                       stats->name, stats->checked, stats->mismatched,
+                       (unsigned long long) stats->gl_us,
+                       (unsigned long long) stats->fb_us);
+    }
+}
+
+static struct glamor_verify_stats *
+glamor_verify_stats(glamor_screen_private *glamor_priv, const char *name)
+{
+    int i;
+
+    for (i = 0; i < GLAMOR_VERIFY_MAX_OPS; i++) {
+        struct glamor_verify_stats *stats = &glamor_priv->verify_stats[i];
+
+        if (!stats->name)
+            stats->name = name;
+        if (!strcmp(stats->name, name))
+            return stats;
+    }
+
+    /* Table full; lump the rest into the last entry */
+    return &glamor_priv->verify_stats[GLAMOR_VERIFY_MAX_OPS - 1];
+}
+
+static void
+glamor_verify_download(glamor_verify *verify, uint8_t *bits)
+{
+    glamor_download_boxes(verify->pixmap, &verify->box, 1, 0, 0,
+                          -verify->box.x1, -verify->box.y1,
+                          bits, verify->stride);
+}
+
+/*
+ * Save the area of the drawable about to be drawn: the extents of
+ * boxes, in the same coordinates as drawable->x/y, or the whole
+ * drawable when nbox is zero.
+ */
+void
+glamor_verify_begin(DrawablePtr drawable, const BoxRec *boxes, int nbox,
+                    glamor_verify *verify)
+{
+    glamor_screen_private *glamor_priv =
+        glamor_get_screen_private(drawable->pScreen);
+    PixmapPtr pixmap;
+    BoxRec box;
+    int off_x, off_y;
+
+    memset(verify, 0, sizeof (*verify));
+
+    if (!glamor_priv->verify_interval || glamor_verify_depth)
+        return;
+
+    if (glamor_priv->verify_count++ % glamor_priv->verify_interval)
+        return;
+
+    pixmap = glamor_get_drawable_pixmap(drawable);
+    if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(glamor_get_pixmap_private(pixmap)))
+        return;
+
+    box.x1 = drawable->x;
+    box.y1 = drawable->y;
+    box.x2 = drawable->x + drawable->width;
+    box.y2 = drawable->y + drawable->height;
+    if (nbox) {
+        BoxRec extents = boxes[0];
+
+        while (--nbox) {
+            boxes++;
+            extents.x1 = MIN(extents.x1, boxes->x1);
+            extents.y1 = MIN(extents.y1, boxes->y1);
+            extents.x2 = MAX(extents.x2, boxes->x2);
+            extents.y2 = MAX(extents.y2, boxes->y2);
+        }
+        box.x1 = MAX(box.x1, extents.x1);
+        box.y1 = MAX(box.y1, extents.y1);
+        box.x2 = MIN(box.x2, extents.x2);
+        box.y2 = MIN(box.y2, extents.y2);
+    }
+
+    glamor_get_drawable_deltas(drawable, pixmap, &off_x, &off_y);
+    box.x1 = MAX(box.x1 + off_x, 0);
+    box.y1 = MAX(box.y1 + off_y, 0);
+    box.x2 = MIN(box.x2 + off_x, pixmap->drawable.width);
+    box.y2 = MIN(box.y2 + off_y, pixmap->drawable.height);
+    if (box.x1 >= box.x2 || box.y1 >= box.y2)
+        return;
+
+    verify->stride = PixmapBytePad(box.x2 - box.x1, pixmap->drawable.depth);
+    verify->before = xallocarray(box.y2 - box.y1, verify->stride);
+    verify->result = xallocarray(box.y2 - box.y1, verify->stride);
+    if (!verify->before || !verify->result) {
+        free(verify->before);
+        free(verify->result);
+        verify->before = verify->result = NULL;
+        return;
+    }
+
+    verify->pixmap = pixmap;
+    verify->box = box;
+    glamor_verify_download(verify, verify->before);
+
+    glamor_verify_depth++;
+    verify->start = GetTimeInMicros();
+}
+
+/*
+ * Called once the GL path has succeeded. Returns TRUE when the
+ * caller should go on to run the fb path for comparison.
+ */
+Bool
+glamor_verify_check(glamor_verify *verify)
+{
+    glamor_screen_private *glamor_priv;
+
+    if (!verify->pixmap)
+        return FALSE;
+
+    glamor_priv = glamor_get_screen_private(verify->pixmap->drawable.pScreen);
+    glamor_make_current(glamor_priv);
+    glFinish();
+    verify->gl_us = GetTimeInMicros() - verify->start;
+
+    glamor_verify_download(verify, verify->result);
+    glamor_upload_boxes(verify->pixmap, &verify->box, 1,
+                        -verify->box.x1, -verify->box.y1, 0, 0,
+                        verify->before, verify->stride);
+
+    verify->checked = TRUE;
+    verify->start = GetTimeInMicros();
+    return TRUE;
+}
+
+static inline uint32_t
+glamor_verify_fetch(const uint8_t *row, int x, int bpp)
+{
+    switch (bpp) {
+    case 1:
+        return (row[x >> 3] >> (x & 7)) & 1;
+    case 8:
+        return row[x];
+    case 16:
+        return ((const uint16_t *) row)[x];
+    default:
+        return ((const uint32_t *) row)[x];
+    }
+}
+
+static void
+glamor_verify_compare(glamor_verify *verify, const char *name,
+                      struct glamor_verify_stats *stats)
+{
+    PixmapPtr pixmap = verify->pixmap;
+    int bpp = pixmap->drawable.bitsPerPixel;
+    int depth = pixmap->drawable.depth;
+    uint32_t mask = depth < 32 ? (1u << depth) - 1 : ~0u;
+    int width = verify->box.x2 - verify->box.x1;
+    int height = verify->box.y2 - verify->box.y1;
+    int first_x = 0, first_y = 0;
+    uint32_t first_gl = 0, first_fb = 0;
+    int max_diff = 0;
+    long count = 0;
+    int x, y, i;
+
+    /* verify->before now holds the fb result */
+    for (y = 0; y < height; y++) {
+        const uint8_t *gl_row = verify->result + y * verify->stride;
+        const uint8_t *fb_row = verify->before + y * verify->stride;
+
+        for (x = 0; x < width; x++) {
+            uint32_t gl = glamor_verify_fetch(gl_row, x, bpp) & mask;
+            uint32_t fb = glamor_verify_fetch(fb_row, x, bpp) & mask;
+
+            if (gl == fb)
+                continue;
+
+            if (!count++) {
+                first_x = x;
+                first_y = y;
+                first_gl = gl;
+                first_fb = fb;
+            }
+
+            for (i = 0; i < bpp; i += 8) {
+                int diff = abs((int) ((gl >> i) & 0xff) -
+                               (int) ((fb >> i) & 0xff));
+
+                max_diff = MAX(max_diff, diff);
+            }
+        }
+    }
+
+    if (!count)
+        return;
+
+    stats->mismatched++;
+    LogMessageVerb(X_WARNING, 0,
+                   "glamor%d: verify %s: %ld of %d pixels differ "
+                   "(max %d per byte), first at %d,%d of depth %d "
+                   "pixmap: gl 0x%08x fb 0x%08x\n",
+                   pixmap->drawable.pScreen->myNum, name,
+                   count, width * height, max_diff,
+                   verify->box.x1 + first_x, verify->box.y1 + first_y,
+                   depth, first_gl, first_fb);
+}
+
+/*
+ * Called after the fb path. Compares the two results when the GL
+ * path ran, then releases everything; safe to call on an inactive
+ * verify.
+ */
+void
+glamor_verify_end(glamor_verify *verify, const char *name)
+{
+    glamor_screen_private *glamor_priv;
+    struct glamor_verify_stats *stats;
+
+    if (!verify->pixmap)
+        return;
+
+    glamor_verify_depth--;
+
+    if (verify->checked) {
+        glamor_priv =
+            glamor_get_screen_private(verify->pixmap->drawable.pScreen);
+        stats = glamor_verify_stats(glamor_priv, name);
+
+        stats->checked++;
+        stats->gl_us += verify->gl_us;
+        stats->fb_us += GetTimeInMicros() - verify->start;
+
+        /* The fb result has been written back to the FBO by now */
+        glamor_verify_download(verify, verify->before);
+        glamor_verify_compare(verify, name, stats);
+    }
+
+    free(verify->before);
+    free(verify->result);
+    verify->pixmap = NULL;
+}
@@ -258,6 +258,10 @@ glamor_xv_render(glamor_port_private *port_priv)
     char *vbo_offset;
     int dst_box_index;
 
+    /* No fallback to take; drop the frame */
+    if (!glamor_pixmap_unshare(pixmap))
+        return;
+
     if (!glamor_priv->xv_prog.prog)
         glamor_init_xv_shader(screen);
 